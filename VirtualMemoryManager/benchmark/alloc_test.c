@@ -0,0 +1,519 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+void test_buddy() {
+    printf("\n=== Testing Buddy Allocator ===\n");
+    struct buddy b;
+
+    // Starts empty; frames become usable once freed
+    assert(buddy_init(&b, 64) == 0);
+    assert(b.free_frames == 0);
+    assert(buddy_alloc(&b, 0) == -1);
+    buddy_free_pages(&b, 0, 64);
+    assert(b.free_frames == 64);
+
+    // Blocks are aligned to their size
+    long f1 = buddy_alloc(&b, 0);
+    long f4 = buddy_alloc(&b, 2);
+    long f8 = buddy_alloc(&b, 3);
+    assert(f1 >= 0 && f4 >= 0 && f8 >= 0);
+    assert(f4 % 4 == 0 && f8 % 8 == 0);
+    assert(f4 + 4 <= f8 || f8 + 8 <= f4);
+    assert(f1 < f4 || f1 >= f4 + 4);
+    assert(b.free_frames == 64 - 1 - 4 - 8);
+
+    // Freed buddies merge back into one block
+    buddy_free(&b, f1, 0);
+    buddy_free(&b, f4, 2);
+    buddy_free(&b, f8, 3);
+    assert(b.free_frames == 64);
+    assert(buddy_alloc(&b, 6) == 0);
+    assert(buddy_alloc(&b, 0) == -1);
+    buddy_free(&b, 0, 6);
+
+    // A run that isn't a power of two keeps only what it asked for, and
+    // its frames can go back one at a time
+    long run = buddy_alloc_pages(&b, 5);
+    assert(run >= 0 && b.free_frames == 59);
+    for (int i = 0; i < 5; i++) buddy_free(&b, run + i, 0);
+    assert(b.free_frames == 64 && buddy_alloc(&b, 6) == 0);
+    buddy_free(&b, 0, 6);
+
+    // Frames past the end never pair up
+    buddy_destroy(&b);
+    assert(buddy_init(&b, 12) == 0);
+    buddy_free_pages(&b, 0, 12);
+    assert(buddy_alloc(&b, 3) == 0);
+    assert(buddy_alloc(&b, 2) == 8);
+    assert(buddy_alloc(&b, 0) == -1);
+    assert(buddy_alloc_pages(&b, 1u << (BUDDY_MAX_ORDER + 1)) == -1);
+    buddy_destroy(&b);
+    printf("Buddy splits, merges and alignment correct\n");
+}
+
+void test_frame_runs() {
+    printf("\n=== Testing Physical Frame Runs ===\n");
+    set_physical_mem();
+    unsigned int before = frame_pool.free_frames;
+
+    // get_next_avail hands out contiguous, zeroed frames
+    char *run = get_next_avail(6);
+    assert(run != NULL);
+    assert((run - (char *)physical_memory) % PGSIZE == 0);
+    assert(frame_pool.free_frames == before - 6);
+    for (int i = 0; i < 6 * PGSIZE; i += 512) assert(run[i] == 0);
+    unsigned long first = (run - (char *)physical_memory) / PGSIZE;
+    for (int i = 0; i < 6; i++) assert(GET_BIT(physical_bitmap, first + i));
+
+    // Page-granular allocations map distinct frames
+    char *a = n_malloc(40 * PGSIZE);
+    assert(a != NULL);
+    for (int i = 0; i < 40; i++) {
+        char *pa = (char *)translate(page_directory, a + i * PGSIZE);
+        assert(pa != NULL);
+        assert(pa < run || pa >= run + 6 * PGSIZE);
+        for (int j = 0; j < i; j++) assert(pa != (char *)translate(page_directory, a + j * PGSIZE));
+    }
+    n_free(a, 40 * PGSIZE);
+    printf("Frames are contiguous, zeroed and never handed out twice\n");
+}
+
+void test_extent() {
+    printf("\n=== Testing Extent Index ===\n");
+    struct extent_map m;
+
+    assert(extent_init(&m, 1, 1000) == 0);
+    assert(m.free_pages == 1000 && m.extents == 1);
+
+    unsigned long a = extent_alloc(&m, 100);
+    unsigned long b = extent_alloc(&m, 10);
+    unsigned long c = extent_alloc(&m, 50);
+    unsigned long d = extent_alloc(&m, 20);
+    unsigned long e = extent_alloc(&m, 30);
+    assert(a == 1 && b == 101 && c == 111 && d == 161 && e == 181);
+    assert(m.free_pages == 790 && m.extents == 1);
+
+    // Holes of 10 and 20 pages: best fit takes the smallest that fits
+    assert(extent_free(&m, b, 10) == 0);
+    assert(extent_free(&m, d, 20) == 0);
+    assert(m.extents == 3);
+    assert(extent_alloc(&m, 8) == b);
+    assert(extent_alloc(&m, 15) == d);
+    assert(extent_free(&m, b, 8) == 0);
+    assert(extent_free(&m, d, 15) == 0);
+
+    // Freeing between free neighbours coalesces; overlaps are refused
+    assert(extent_free(&m, c, 50) == 0);
+    assert(m.extents == 2);                 // [101, 181) and the tail
+    assert(extent_free(&m, c + 10, 5) == -1);
+    assert(extent_free(&m, e - 5, 10) == -1);
+    assert(m.free_pages == 870);
+    assert(extent_alloc(&m, 80) == b);
+    assert(extent_free(&m, b, 80) == 0);
+
+    // Aligned: the skipped pages stay free
+    unsigned long al = extent_alloc_aligned(&m, 30, 64);
+    assert(al % 64 == 0 && al >= 101);
+    assert(m.free_pages == 840);
+    assert(extent_free(&m, al, 30) == 0);
+
+    // Everything back: one extent again
+    assert(extent_free(&m, a, 100) == 0);
+    assert(extent_free(&m, e, 30) == 0);
+    assert(m.free_pages == 1000 && m.extents == 1);
+    assert(extent_alloc(&m, 1001) == 0);
+    assert(extent_alloc(&m, 1000) == 1);
+    assert(extent_alloc(&m, 1) == 0);
+    extent_destroy(&m);
+
+    // Through the engine: a freed hole is reused by a request that fits
+    char *x = n_malloc(300 * PGSIZE);
+    char *y = n_malloc(200 * PGSIZE);
+    char *z = n_malloc(300 * PGSIZE);
+    assert(x && y && z);
+    n_free(y, 200 * PGSIZE);
+    char *w = n_malloc(150 * PGSIZE);
+    assert(w == y);
+    n_free(w, 150 * PGSIZE);
+    n_free(x, 300 * PGSIZE);
+    n_free(z, 300 * PGSIZE);
+    printf("Best fit, coalescing and double-free checks correct\n");
+}
+
+void test_extent_aligned() {
+    printf("\n=== Testing Aligned Extent Search ===\n");
+    struct extent_map m;
+
+    // Many short extents that can't hold an aligned run, then one that can
+    assert(extent_init(&m, 1, 100000) == 0);
+    assert(extent_alloc(&m, 100000) == 1);
+    for (unsigned long v = 3; v < 60000; v += 64) assert(extent_free(&m, v, 40) == 0);
+    assert(extent_free(&m, 70001, 3000) == 0);
+    unsigned long al = extent_alloc_aligned(&m, 1024, 1024);
+    assert(al == 70656);
+    assert(extent_free(&m, al, 1024) == 0);
+
+    // Past the probes the smallest long extent is taken
+    assert(extent_alloc_aligned(&m, 32, 64) == 70016);
+    assert(extent_free(&m, 70016, 32) == 0);
+
+    // A short extent that happens to be aligned wins over a long one
+    assert(extent_free(&m, 90000, 3000) == 0);
+    assert(extent_free(&m, 65536, 36) == 0);
+    assert(extent_alloc_aligned(&m, 32, 32) == 65536);
+    assert(extent_free(&m, 65536, 32) == 0);
+    extent_destroy(&m);
+
+    // Random maps: every aligned result fits, lies in free space and is
+    // found whenever some extent holds an aligned run
+    unsigned int x = 88172645u;
+    for (int round = 0; round < 100; round++) {
+        assert(extent_init(&m, 1, 20000) == 0);
+        assert(extent_alloc(&m, 20000) == 1);
+        static unsigned char used[20001];
+        memset(used, 1, sizeof(used));
+        for (int i = 0; i < 200; i++) {
+            xorshift32(&x);
+            unsigned long start = 1 + x % 19900, len = 1 + (x >> 16) % 100;
+            if (start + len > 20001) continue;
+            int clear = 1;
+            for (unsigned long v = start - (start > 1); v < start + len + 1 && v <= 20000; v++) clear &= used[v];
+            if (!clear) continue;
+            assert(extent_free(&m, start, len) == 0);
+            memset(used + start, 0, len);
+        }
+        unsigned long npages = 1 + x % 40, align = 1UL << (x >> 8) % 7;
+        int possible = 0;
+        for (unsigned long v = align; v + npages <= 20001 && !possible; v += align) {
+            int fits = 1;
+            for (unsigned long j = 0; j < npages && fits; j++) fits = !used[v + j];
+            possible = fits;
+        }
+        unsigned long got = extent_alloc_aligned(&m, npages, align);
+        assert(!got == !possible);
+        if (got) {
+            assert(got % align == 0);
+            for (unsigned long j = 0; j < npages; j++) assert(!used[got + j]);
+        }
+        extent_destroy(&m);
+    }
+    printf("Aligned search finds fits without walking every extent\n");
+}
+
+// One-bit-at-a-time references for the word-wide scans
+static long naive_find(const unsigned char *map, unsigned long start, unsigned long nbits, int want) {
+    for (unsigned long i = start; i < nbits; i++)
+        if ((int)GET_BIT(map, i) == want) return (long)i;
+    return -1;
+}
+
+static long naive_zero_run(const unsigned char *map, unsigned long start, unsigned long nbits,
+                           unsigned long run) {
+    unsigned long len = 0;
+    for (unsigned long i = start; i < nbits; i++) {
+        len = GET_BIT(map, i) ? 0 : len + 1;
+        if (run && len == run) return (long)(i + 1 - run);
+    }
+    return -1;
+}
+
+void test_bitmap() {
+    printf("\n=== Testing Bitmap Scans ===\n");
+    unsigned long nbits = 5000;
+    unsigned char *map = bitmap_alloc(nbits);
+    assert(map != NULL);
+
+    // Empty and full maps, with bounds that aren't word multiples
+    assert(bitmap_find_first_zero(map, 0, nbits) == 0);
+    assert(bitmap_find_first_set(map, 0, nbits) == -1);
+    assert(bitmap_find_zero_run(map, 7, nbits, nbits - 7) == 7);
+    assert(bitmap_find_zero_run(map, 0, nbits, nbits + 1) == -1);
+    assert(bitmap_find_zero_run(map, 0, nbits, 0) == -1);
+    bitmap_set_range(map, 0, nbits);
+    assert(bitmap_find_first_zero(map, 0, nbits) == -1);
+    assert(bitmap_find_first_zero(map, 0, nbits - 1) == -1);
+    assert(bitmap_find_first_set(map, nbits - 1, nbits) == (long)nbits - 1);
+
+    // Single holes at word and vector boundaries on a nearly full map
+    unsigned long holes[] = { 0, 63, 64, 255, 256, 1023, 4999 };
+    for (int h = 0; h < 7; h++) {
+        CLEAR_BIT(map, holes[h]);
+        assert(bitmap_find_first_zero(map, 0, nbits) == (long)holes[h]);
+        assert(bitmap_find_first_zero(map, holes[h] + 1, nbits) == -1);
+        assert(bitmap_find_zero_run(map, 0, nbits, 1) == (long)holes[h]);
+        assert(bitmap_find_zero_run(map, 0, nbits, 2) == -1);
+        SET_BIT(map, holes[h]);
+    }
+
+    // Ranges straddling words agree with the byte macros
+    bitmap_clear_range(map, 0, nbits);
+    bitmap_set_range(map, 60, 10);
+    bitmap_set_range(map, 128, 256);
+    for (unsigned long i = 0; i < 400; i++)
+        assert(GET_BIT(map, i) == ((i >= 60 && i < 70) || (i >= 128 && i < 384)));
+    bitmap_clear_range(map, 61, 8);
+    assert(GET_BIT(map, 60) && !GET_BIT(map, 61) && !GET_BIT(map, 68) && GET_BIT(map, 69));
+
+    // Random maps at varying density against the references
+    unsigned int x = RNG_SEED;
+    for (int round = 0; round < 200; round++) {
+        bitmap_clear_range(map, 0, nbits);
+        unsigned int density = round % 8;   // 0 = sparse .. 7 = nearly full
+        for (unsigned long i = 0; i < nbits; i++) {
+            xorshift32(&x);
+            if (x % 8 < density || (density == 7 && x % 64)) SET_BIT(map, i);
+        }
+        xorshift32(&x);
+        unsigned long start = x % nbits;
+        unsigned long run = 1 + x % 40;
+        assert(bitmap_find_first_zero(map, start, nbits) == naive_find(map, start, nbits, 0));
+        assert(bitmap_find_first_set(map, start, nbits) == naive_find(map, start, nbits, 1));
+        assert(bitmap_find_zero_run(map, start, nbits, run) == naive_zero_run(map, start, nbits, run));
+    }
+    free(map);
+    printf("Word-wide scans match the bit-at-a-time reference\n");
+}
+
+// Page supply for a standalone slab allocator: vpns handed out in order
+static unsigned long fake_next_vpn = 100, fake_pages_out;
+
+static unsigned long fake_get_page(void) {
+    fake_pages_out++;
+    return fake_next_vpn++;
+}
+
+static void fake_put_page(unsigned long vpn) {
+    (void)vpn;
+    fake_pages_out--;
+}
+
+void test_slab() {
+    printf("\n=== Testing Slab Allocator ===\n");
+    struct slab_allocator a;
+    slab_init(&a, PGSIZE, fake_get_page, fake_put_page);
+
+    // Requests round up to their class and pack into one page
+    unsigned long objs[PGSIZE / 16];
+    for (int i = 0; i < PGSIZE / 16; i++) {
+        objs[i] = slab_alloc(&a, 10);
+        assert(objs[i] != 0 && objs[i] % 16 == 0);
+        assert(objs[i] / PGSIZE == 100);
+        for (int j = 0; j < i; j++) assert(objs[i] != objs[j]);
+    }
+    assert(fake_pages_out == 1 && a.objects[0] == PGSIZE / 16);
+
+    // A full slab spills into a new page; frees make room again
+    unsigned long spill = slab_alloc(&a, 16);
+    assert(spill / PGSIZE == 101 && fake_pages_out == 2);
+    assert(slab_free(&a, objs[5]) == 0);
+    assert(slab_free(&a, objs[5]) == 0);        // Double free is ignored
+    assert(a.objects[0] == PGSIZE / 16);
+    assert(slab_free(&a, objs[6] + 1) == 0);    // So is a misaligned one
+    assert(a.objects[0] == PGSIZE / 16);
+
+    // Other classes get their own pages; large sizes and unknown pages are refused
+    unsigned long big = slab_alloc(&a, 1500);
+    assert(big % 2048 == 0 && big / PGSIZE == 102);
+    assert(slab_alloc(&a, SLAB_MAX_SIZE + 1) == 0);
+    assert(slab_free(&a, 500 * PGSIZE) == -1);
+
+    // An emptied slab goes back unless it's the last of its class
+    assert(slab_free(&a, spill) == 0);
+    assert(fake_pages_out == 2);
+    assert(slab_free(&a, big) == 0);
+    assert(fake_pages_out == 2);
+    slab_destroy(&a);
+
+    // Through the engine: a thousand small objects fit in a handful of frames
+    set_physical_mem();
+    static char *small[1000];
+    for (int i = 0; i < 1000; i++) {
+        small[i] = n_malloc(10);
+        assert(small[i] != NULL);
+        int v = i;
+        assert(put_data(small[i], &v, sizeof(v)) == 0);
+    }
+    // Count the distinct pages behind the objects; va and pa share the offset
+    static char *page[1000];
+    int pages = 0;
+    for (int i = 0; i < 1000; i++) {
+        char *pa = (char *)translate(page_directory, small[i]);
+        page[i] = small[i] - (pa - (char *)physical_memory) % PGSIZE;
+        int seen = 0;
+        for (int j = 0; j < i; j++) seen |= page[j] == page[i];
+        pages += !seen;
+    }
+    assert(pages <= 1000 * 16 / PGSIZE + 1);
+    for (int i = 0; i < 1000; i++) {
+        int v = -1;
+        get_data(small[i], &v, sizeof(v));
+        assert(v == i);
+    }
+    for (int i = 0; i < 1000; i++) n_free(small[i], 10);
+    char *again = n_malloc(10);
+    assert(again != NULL);
+    n_free(again, 10);
+    printf("Size classes pack small objects and route frees back\n");
+}
+
+#define MAG_THREADS 8
+#define MAG_ROUNDS 2000
+
+// Each thread keeps a few live blocks of mixed sizes, stamps them with its
+// id and checks the stamps survive the other threads' churn
+static void *mag_worker(void *arg) {
+    int id = (int)(long)arg;
+    char *live[4] = { NULL };
+    unsigned int sizes[4] = { 0 };
+    unsigned int x = RNG_SEED + id;
+    int mark = 0;
+
+    for (int r = 0; r < MAG_ROUNDS; r++) {
+        xorshift32(&x);
+        int k = x % 4;
+        for (int j = 0; j < 4; j++) {
+            if (live[j]) {
+                int v = -1;
+                get_data(live[j] + sizes[j] - sizeof(v), &v, sizeof(v));
+                assert(v == mark);
+            }
+        }
+        if (live[k]) n_free(live[k], sizes[k]);
+        sizes[k] = (1 + x % 20) * PGSIZE;
+        live[k] = n_malloc(sizes[k]);
+        assert(live[k] != NULL);
+        mark = id * MAG_ROUNDS + r;
+        for (int j = 0; j < 4; j++) {
+            if (live[j]) assert(put_data(live[j] + sizes[j] - sizeof(mark), &mark, sizeof(mark)) == 0);
+        }
+    }
+    for (int k = 0; k < 4; k++) n_free(live[k], sizes[k]);
+    return NULL;
+}
+
+void test_magazines() {
+    printf("\n=== Testing Per-Thread Caches ===\n");
+    set_physical_mem();
+    unsigned int before = frame_pool.free_frames;
+
+    pthread_t th[MAG_THREADS];
+    for (long i = 0; i < MAG_THREADS; i++) pthread_create(&th[i], NULL, mag_worker, (void *)i);
+    for (int i = 0; i < MAG_THREADS; i++) pthread_join(th[i], NULL);
+
+    // A freed range is reused by the same thread without going global
+    char *a = n_malloc(3 * PGSIZE);
+    n_free(a, 3 * PGSIZE);
+    char *b = n_malloc(3 * PGSIZE);
+    assert(b == a);
+
+    // Whatever the caches hold is still free memory, not lost
+    char *big = n_malloc((before / 2) * PGSIZE);
+    assert(big != NULL);
+    n_free(big, (before / 2) * PGSIZE);
+    n_free(b, 3 * PGSIZE);
+    printf("Concurrent churn keeps every block intact\n");
+}
+
+void test_double_free() {
+    printf("\n=== Testing Repeated Frees ===\n");
+    set_physical_mem();
+
+    // A cached range freed twice must not be handed out twice
+    char *a = n_malloc(4 * PGSIZE);
+    n_free(a, 4 * PGSIZE);
+    n_free(a, 4 * PGSIZE);
+    char *p = n_malloc(4 * PGSIZE);
+    char *q = n_malloc(4 * PGSIZE);
+    assert(p && q && p != q);
+
+    // Freeing one owner leaves the other mapped
+    int v = 42;
+    assert(put_data(q, &v, sizeof(v)) == 0);
+    n_free(p, 4 * PGSIZE);
+    n_free(p, 4 * PGSIZE);
+    v = 0;
+    assert(put_data(q, &v, sizeof(v)) == 0);
+    get_data(q, &v, sizeof(v));
+    assert(v == 0);
+
+    // Same for a page taken back by the thread's bump chunk
+    char *r = n_malloc(PGSIZE);
+    n_free(r, PGSIZE);
+    n_free(r, PGSIZE);
+    char *s1 = n_malloc(PGSIZE);
+    char *s2 = n_malloc(PGSIZE);
+    assert(s1 && s2 && s1 != s2);
+    assert(put_data(q, &v, sizeof(v)) == 0);
+    n_free(q, 4 * PGSIZE);
+    n_free(s1, PGSIZE);
+    n_free(s2, PGSIZE);
+    printf("Repeated frees are ignored\n");
+}
+
+// Resident set size in pages, from /proc
+static long resident_pages() {
+    long size = 0, resident = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = -1;
+        fclose(f);
+    }
+    return resident;
+}
+
+// Runs before anything else sets up memory, to see what startup costs
+void test_lazy_memory() {
+    printf("\n=== Testing Lazy Physical Memory ===\n");
+    long before = resident_pages();
+    set_physical_mem();
+    long after = resident_pages();
+    long host_page = sysconf(_SC_PAGESIZE);
+    if (before >= 0 && after >= 0) {
+        assert((after - before) * host_page < MEMSIZE / 16);
+    }
+
+    // Fresh frames read as zero without having been cleared up front
+    char *a = n_malloc(64 * PGSIZE);
+    assert(a != NULL);
+    char buf[PGSIZE];
+    for (int i = 0; i < 64; i++) {
+        memset(buf, 1, PGSIZE);
+        get_data(a + i * PGSIZE, buf, PGSIZE);
+        for (int j = 0; j < PGSIZE; j++) assert(buf[j] == 0);
+    }
+
+    // Dirty frames are zeroed again before they are reused
+    memset(buf, 0xAB, PGSIZE);
+    for (int i = 0; i < 64; i++) assert(put_data(a + i * PGSIZE, buf, PGSIZE) == 0);
+    n_free(a, 64 * PGSIZE);
+    char *b = n_malloc(64 * PGSIZE);
+    assert(b != NULL);
+    for (int i = 0; i < 64; i++) {
+        get_data(b + i * PGSIZE, buf, PGSIZE);
+        for (int j = 0; j < PGSIZE; j++) assert(buf[j] == 0);
+    }
+    n_free(b, 64 * PGSIZE);
+    printf("Startup stays small and every frame starts zeroed\n");
+}
+
+int main() {
+    printf("Starting allocator tests...\n");
+
+    test_lazy_memory();
+    test_buddy();
+    test_frame_runs();
+    test_extent();
+    test_extent_aligned();
+    test_bitmap();
+    test_slab();
+    test_magazines();
+    test_double_free();
+
+    printf("\nAll allocator tests passed!\n");
+    return 0;
+}
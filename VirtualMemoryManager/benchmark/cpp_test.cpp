@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "../my_vm.hpp"
+#include "test_util.h"
+
+// Copy-on-write fault counter kept by the library
+extern "C" unsigned long long cow_faults;
+
+// Small integers, so float and double products are exact too
+static int next_small() {
+    return (int)(next_rand() % 21) - 10;
+}
+
+template <typename T>
+static void check_gemm(int size) {
+    unsigned int bytes = size * size * sizeof(T);
+    std::vector<T> a(size * size), b(size * size), want(size * size), got(size * size);
+    for (int i = 0; i < size * size; i++) {
+        a[i] = (T)next_small();
+        b[i] = (T)next_small();
+    }
+    for (int i = 0; i < size; i++)
+        for (int j = 0; j < size; j++) {
+            T sum = T();
+            for (int k = 0; k < size; k++) sum += a[i * size + k] * b[k * size + j];
+            want[i * size + j] = sum;
+        }
+
+    void *va = n_malloc(bytes), *vb = n_malloc(bytes), *vc = n_malloc(bytes);
+    assert(va && vb && vc);
+    assert(put_data(va, a.data(), bytes) == 0);
+    assert(put_data(vb, b.data(), bytes) == 0);
+    assert(vm::gemm<T>(va, vb, size, vc) == 0);
+    get_data(vc, got.data(), bytes);
+    assert(got == want);
+
+    // gemv against column 0 of b
+    std::vector<T> x(size), y(size);
+    for (int i = 0; i < size; i++) x[i] = b[i * size];
+    void *vx = n_malloc(size * sizeof(T)), *vy = n_malloc(size * sizeof(T));
+    assert(vx && vy);
+    assert(put_data(vx, x.data(), size * sizeof(T)) == 0);
+    assert(vm::gemv<T>(va, vx, size, vy) == 0);
+    get_data(vy, y.data(), size * sizeof(T));
+    for (int i = 0; i < size; i++) assert(y[i] == want[i * size]);
+
+    n_free(va, bytes);
+    n_free(vb, bytes);
+    n_free(vc, bytes);
+    n_free(vx, size * sizeof(T));
+    n_free(vy, size * sizeof(T));
+}
+
+template <typename T>
+static void check_all_sizes() {
+    int sizes[] = { 1, 5, 37, 130, 300 };
+    for (int s = 0; s < 5; s++) check_gemm<T>(sizes[s]);
+}
+
+void test_typed_kernels() {
+    printf("\n=== Testing vm::gemm / vm::gemv ===\n");
+    set_physical_mem();
+
+    check_all_sizes<int32_t>();
+    check_all_sizes<int64_t>();
+    check_all_sizes<float>();
+    check_all_sizes<double>();
+
+    // Non-positive sizes are no-ops
+    assert(vm::gemm<double>(NULL, NULL, 0, NULL) == 0);
+    assert(vm::gemv<float>(NULL, NULL, -1, NULL) == 0);
+    printf("Every element type matches the naive product\n");
+}
+
+void test_ptr_span() {
+    printf("\n=== Testing vm::ptr / vm::span ===\n");
+    set_physical_mem();
+
+    // Element access through ptr copies via the engine
+    const int n = 4000;
+    int *va = (int *)n_malloc(4 * PGSIZE);
+    assert(va != NULL);
+    vm::ptr<int> p(va);
+    for (int i = 0; i < n; i++) p[i] = next_small();
+    std::vector<int> host(n);
+    get_data(va, host.data(), n * sizeof(int));
+    assert(std::accumulate(p, p + n, 0L) == std::accumulate(host.begin(), host.end(), 0L));
+    assert(p + n - p == n && *(p + 5) == host[5]);
+
+    // A span starting mid-page and crossing pages indexes the same memory
+    {
+        vm::span<int> s(p + (PGSIZE / sizeof(int) - 3), 2000);
+        assert(s && s.size() == 2000);
+        for (int i = 0; i < 2000; i++) assert(s[i] == host[PGSIZE / sizeof(int) - 3 + i]);
+        std::sort(s.begin(), s.end());
+        assert(std::is_sorted(s.begin(), s.end()));
+        s[0] = -1000;
+    }
+    get_data(va, host.data(), n * sizeof(int));
+    assert(host[PGSIZE / sizeof(int) - 3] == -1000);
+    assert(std::is_sorted(host.begin() + PGSIZE / sizeof(int) - 2, host.begin() + PGSIZE / sizeof(int) - 3 + 2000));
+
+    // Misaligned or unmapped ranges give an empty span
+    vm::span<int> bad((char *)va + 2, 10);
+    assert(!bad && bad.empty() && bad.begin() == bad.end());
+    n_free(va, 4 * PGSIZE);
+    vm::span<int> gone(va, 10);
+    assert(!gone);
+    printf("Spans index, sort and write back across pages\n");
+}
+
+void test_const_span() {
+    printf("\n=== Testing span<const T> over forked pages ===\n");
+    set_physical_mem();
+
+    // Both copies of a fork read through one frame per page
+    const int n = 4 * PGSIZE / sizeof(int);
+    int *a = (int *)n_malloc(4 * PGSIZE);
+    assert(a != NULL);
+    std::vector<int> host(n);
+    for (int i = 0; i < n; i++) host[i] = i;
+    assert(put_data(a, host.data(), 4 * PGSIZE) == 0);
+    int *b = (int *)n_fork(a, 4 * PGSIZE);
+    assert(b != NULL);
+
+    unsigned long long faults = cow_faults;
+    {
+        vm::span<const int> ca(a, n), cb(b, n);
+        assert(ca && cb);
+        assert(std::accumulate(cb.begin(), cb.end(), 0L) == (long)n * (n - 1) / 2);
+        for (int i = 0; i < n; i += PGSIZE / sizeof(int)) assert(&ca[i] == &cb[i]);
+        assert(cow_faults == faults);
+
+        // A write to one copy moves it off the shared frame; the read
+        // view still has the data as of the pin
+        int v = -1;
+        assert(put_data(a, &v, sizeof(v)) == 0);
+        assert(cow_faults == faults + 1);
+        assert(ca[0] == 0 && cb[0] == 0);
+    }
+
+    // A writable span does break the sharing, for its copy only
+    const int second = PGSIZE / sizeof(int) + 1;
+    {
+        vm::span<int> wb(b + second, 10);
+        assert(wb);
+        assert(cow_faults == faults + 2);
+        wb[0] = 12345;
+    }
+    int got;
+    get_data(a + second, &got, sizeof(got));
+    assert(got == second);
+    get_data(b + second, &got, sizeof(got));
+    assert(got == 12345);
+    get_data(a, &got, sizeof(got));
+    assert(got == -1);
+    get_data(b, &got, sizeof(got));
+    assert(got == 0);
+
+    n_free(a, 4 * PGSIZE);
+    n_free(b, 4 * PGSIZE);
+    printf("Read-only spans leave forked pages shared\n");
+}
+
+int main() {
+    printf("Starting C++ interface tests...\n");
+
+    test_typed_kernels();
+    test_ptr_span();
+    test_const_span();
+
+    printf("\nAll C++ interface tests passed!\n");
+    return 0;
+}
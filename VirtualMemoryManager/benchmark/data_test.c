@@ -0,0 +1,213 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+#define REGION (16 * PGSIZE)
+
+// The whole region must match the host-side reference
+static void check_region(char *va, const char *ref) {
+    static char buf[REGION];
+    get_data(va, buf, REGION);
+    assert(memcmp(buf, ref, REGION) == 0);
+}
+
+void test_memops() {
+    printf("\n=== Testing n_memcpy / n_memmove / n_memset ===\n");
+    set_physical_mem();
+
+    static char ref[REGION], tmp[REGION];
+    char *va = n_malloc(REGION);
+    assert(va != NULL);
+    for (int i = 0; i < REGION; i++) ref[i] = (char)next_rand();
+    assert(put_data(va, ref, REGION) == 0);
+
+    // Random unaligned, page-crossing and overlapping operations, mirrored
+    // on the host
+    for (int round = 0; round < 300; round++) {
+        unsigned int len = next_rand() % (3 * PGSIZE);
+        unsigned int src = next_rand() % (REGION - len + 1);
+        unsigned int dst = next_rand() % (REGION - len + 1);
+        switch (round % 3) {
+        case 0:
+            // Non-overlapping only: memcpy makes no promise otherwise
+            if (src < dst + len && dst < src + len) continue;
+            assert(n_memcpy(va + dst, va + src, len) == 0);
+            memcpy(ref + dst, ref + src, len);
+            break;
+        case 1:
+            assert(n_memmove(va + dst, va + src, len) == 0);
+            memmove(ref + dst, ref + src, len);
+            break;
+        default:
+            assert(n_memset(va + dst, round & 0xFF, len) == 0);
+            memset(ref + dst, round & 0xFF, len);
+            break;
+        }
+        check_region(va, ref);
+    }
+
+    // Between allocations, including small slab objects
+    char *other = n_malloc(REGION);
+    char *small = n_malloc(100);
+    assert(other && small);
+    assert(n_memcpy(other + 7, va + PGSIZE - 3, 2 * PGSIZE) == 0);
+    get_data(other + 7, tmp, 2 * PGSIZE);
+    assert(memcmp(tmp, ref + PGSIZE - 3, 2 * PGSIZE) == 0);
+    assert(n_memcpy(small, va + 50, 100) == 0);
+    get_data(small, tmp, 100);
+    assert(memcmp(tmp, ref + 50, 100) == 0);
+
+    // Zero length does nothing; unmapped ranges and NULL fail
+    assert(n_memcpy(other, va, 0) == 0);
+    assert(n_memset(va, 0, 0) == 0);
+    assert(n_memcpy(NULL, va, 10) == -1);
+    assert(n_memset(NULL, 0, 10) == -1);
+    n_free(other, REGION);
+    assert(n_memcpy(other, va, PGSIZE) == -1);
+    assert(n_memcpy(va, other, PGSIZE) == -1);
+    assert(n_memset(other, 0, 1) == -1);
+    check_region(va, ref);
+
+    n_free(small, 100);
+    n_free(va, REGION);
+    printf("Frame-to-frame copies match memcpy/memmove/memset\n");
+}
+
+#define IOV_COUNT 500
+
+void test_iov() {
+    printf("\n=== Testing put_data_v / get_data_v ===\n");
+    set_physical_mem();
+
+    static char ref[REGION], src[IOV_COUNT][64], dst[IOV_COUNT][64];
+    struct vm_iov iov[IOV_COUNT];
+    char *va = n_malloc(REGION);
+    assert(va != NULL);
+    memset(ref, 0, REGION);
+    assert(put_data(va, ref, REGION) == 0);
+
+    // Unsorted descriptors, some crossing pages and some overlapping: the
+    // later one wins where they overlap, as with put_data in a loop
+    for (int i = 0; i < IOV_COUNT; i++) {
+        unsigned int len = next_rand() % 64;
+        unsigned int off = next_rand() % (REGION - 64);
+        if (i % 10 == 0) off = (next_rand() % 15 + 1) * PGSIZE - len / 2;
+        if (i % 25 == 1) off = (char *)iov[i - 1].va - va + 1;
+        for (unsigned int j = 0; j < len; j++) src[i][j] = (char)next_rand();
+        iov[i].va = va + off;
+        iov[i].buf = src[i];
+        iov[i].len = len;
+        memcpy(ref + off, src[i], len);
+    }
+    assert(put_data_v(iov, IOV_COUNT) == 0);
+    static char back[REGION];
+    get_data(va, back, REGION);
+    assert(memcmp(back, ref, REGION) == 0);
+
+    // Reading back gives every descriptor its bytes
+    for (int i = 0; i < IOV_COUNT; i++) iov[i].buf = dst[i];
+    assert(get_data_v(iov, IOV_COUNT) == 0);
+    for (int i = 0; i < IOV_COUNT; i++) {
+        assert(memcmp(dst[i], ref + ((char *)iov[i].va - va), iov[i].len) == 0);
+    }
+
+    // Batches already in page order take the streaming path
+    for (int i = 0; i < 64; i++) {
+        iov[i].va = va + i * 256;
+        iov[i].buf = src[i];
+        iov[i].len = 64;
+        memcpy(ref + i * 256, src[i], 64);
+    }
+    assert(put_data_v(iov, 64) == 0);
+    get_data(va, back, REGION);
+    assert(memcmp(back, ref, REGION) == 0);
+
+    // Empty batches succeed; bad descriptors and unmapped pages fail
+    assert(put_data_v(iov, 0) == 0);
+    assert(put_data_v(NULL, 1) == -1);
+    iov[1].buf = NULL;
+    assert(get_data_v(iov, 2) == -1);
+    iov[1].buf = src[1];
+    char *gone = n_malloc(PGSIZE);
+    n_free(gone, PGSIZE);
+    iov[1].va = gone;
+    assert(put_data_v(iov, 2) == -1);
+
+    n_free(va, REGION);
+    printf("Batched transfers match per-element put_data/get_data\n");
+}
+
+void test_pin() {
+    printf("\n=== Testing n_pin / n_unpin ===\n");
+    set_physical_mem();
+
+    // A page-crossing range comes back as host pointers that alias the
+    // simulated memory both ways
+    char *va = n_malloc(8 * PGSIZE);
+    assert(va != NULL);
+    struct iovec iov[8];
+    unsigned int len = 3 * PGSIZE + 100;
+    int n = n_pin(va + PGSIZE - 50, len, iov, 8);
+    assert(n >= 1 && n <= 5);
+    unsigned long total = 0;
+    for (int i = 0; i < n; i++) total += iov[i].iov_len;
+    assert(total == len);
+
+    char *first = (char *)iov[0].iov_base;
+    memcpy(first, "pinned", 7);
+    char buf[8];
+    get_data(va + PGSIZE - 50, buf, 7);
+    assert(strcmp(buf, "pinned") == 0);
+    assert(put_data(va + PGSIZE - 50, "direct", 7) == 0);
+    assert(memcmp(first, "direct", 7) == 0);
+
+    // Freed while pinned: the frames stay ours until n_unpin, whatever
+    // gets allocated meanwhile
+    n_free(va, 8 * PGSIZE);
+    char *others[32];
+    for (int i = 0; i < 32; i++) {
+        others[i] = n_malloc(8 * PGSIZE);
+        assert(others[i] != NULL);
+        assert(n_memset(others[i], 0xEE, 8 * PGSIZE) == 0);
+    }
+    assert(memcmp(first, "direct", 7) == 0);
+    for (int i = 0; i < n; i++) {
+        char *p = (char *)iov[i].iov_base;
+        for (unsigned long j = (i == 0 ? 7 : 0); j < iov[i].iov_len; j++) assert(p[j] == 0);
+    }
+    n_unpin(iov, n);
+    for (int i = 0; i < 32; i++) n_free(others[i], 8 * PGSIZE);
+
+    // Too few entries or an unmapped page: nothing stays pinned
+    char *a = n_malloc(4 * PGSIZE);
+    char *b = n_malloc(4 * PGSIZE);
+    assert(a && b);
+    assert(n_pin(a, 4 * PGSIZE, iov, 0) == -1);
+    n_free(b, 4 * PGSIZE);
+    assert(n_pin(b, PGSIZE, iov, 8) == -1);
+    assert(n_pin(NULL, PGSIZE, iov, 8) == -1);
+
+    // A pinned range that stays mapped is unaffected by the unpin
+    n = n_pin(a, 4 * PGSIZE, iov, 8);
+    assert(n >= 1);
+    memset(iov[0].iov_base, 'x', 10);
+    n_unpin(iov, n);
+    get_data(a, buf, 8);
+    assert(memcmp(buf, "xxxxxxxx", 8) == 0);
+    n_free(a, 4 * PGSIZE);
+    printf("Pinned views alias memory and outlive n_free until unpinned\n");
+}
+
+int main() {
+    printf("Starting data movement tests...\n");
+
+    test_memops();
+    test_iov();
+    test_pin();
+
+    printf("\nAll data movement tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+// Copy-on-write state kept by the library
+extern unsigned long long cow_faults;
+extern unsigned long long major_faults;
+extern unsigned int *frame_shares;
+
+#define PAGES 64
+
+static unsigned long frame_of(void *va) {
+    return ((char *)translate(page_directory, va) - (char *)physical_memory) / PGSIZE;
+}
+
+void test_fork() {
+    printf("\n=== Testing n_fork ===\n");
+    set_physical_mem();
+
+    // A fork shares every frame with the original and copies nothing
+    char *va = n_malloc(PAGES * PGSIZE);
+    assert(va != NULL);
+    stamp(va, PAGES, 0);
+    unsigned long long faults = cow_faults;
+    char *copy = n_fork(va, PAGES * PGSIZE);
+    assert(copy != NULL && copy != va);
+    check_stamp(copy, PAGES, 0);
+    check_stamp(va, PAGES, 0);
+    for (unsigned int i = 0; i < PAGES; i++) {
+        assert(frame_of(va + i * PGSIZE) == frame_of(copy + i * PGSIZE));
+        assert(frame_shares[frame_of(va + i * PGSIZE)] == 1);
+    }
+    assert(cow_faults == faults);
+
+    // The first write to a page copies it for the writer alone
+    unsigned int v = 0xC0FFEE;
+    assert(put_data(copy + 3 * PGSIZE + 8, &v, sizeof(v)) == 0);
+    assert(cow_faults == faults + 1);
+    assert(frame_of(copy + 3 * PGSIZE) != frame_of(va + 3 * PGSIZE));
+    assert(frame_shares[frame_of(va + 3 * PGSIZE)] == 0);
+    unsigned int got = 0;
+    get_data(va + 3 * PGSIZE + 8, &got, sizeof(got));
+    assert(got == 0);
+    get_data(copy + 3 * PGSIZE, &got, sizeof(got));
+    assert(got == 3);
+
+    // The other side then takes its frame back without a copy
+    assert(put_data(va + 3 * PGSIZE + 8, &v, sizeof(v)) == 0);
+    assert(cow_faults == faults + 1);
+    assert(put_data(va + 5 * PGSIZE, &v, sizeof(v)) == 0);
+    assert(cow_faults == faults + 2);
+    get_data(copy + 5 * PGSIZE, &got, sizeof(got));
+    assert(got == 5);
+
+    // A fork of the fork shares three ways
+    char *third = n_fork(copy, PAGES * PGSIZE);
+    assert(third != NULL);
+    assert(frame_shares[frame_of(third + 10 * PGSIZE)] == 2);
+    stamp(third, PAGES, 1000);
+    check_stamp(third, PAGES, 1000);
+    get_data(copy + 10 * PGSIZE, &got, sizeof(got));
+    assert(got == 10);
+    assert(frame_shares[frame_of(va + 10 * PGSIZE)] == 1);
+
+    // Freeing one side leaves the other's data and unshares its frames
+    n_free(va, PAGES * PGSIZE);
+    get_data(copy + 10 * PGSIZE, &got, sizeof(got));
+    assert(got == 10);
+    assert(frame_shares[frame_of(copy + 10 * PGSIZE)] == 0);
+    faults = cow_faults;
+    stamp(copy, PAGES, 2000);
+    assert(cow_faults == faults);
+    check_stamp(copy, PAGES, 2000);
+    check_stamp(third, PAGES, 1000);
+    n_free(copy, PAGES * PGSIZE);
+    n_free(third, PAGES * PGSIZE);
+    assert(translate(page_directory, third) == NULL);
+
+    // Small objects are copied; bad arguments fail
+    char *small = n_malloc(100);
+    assert(small != NULL);
+    assert(put_data(small, "slab object", 12) == 0);
+    char *small_copy = n_fork(small, 100);
+    assert(small_copy != NULL && small_copy != small);
+    char buf[12];
+    get_data(small_copy, buf, 12);
+    assert(strcmp(buf, "slab object") == 0);
+    assert(n_fork(NULL, PGSIZE) == NULL);
+    assert(n_fork(small, 0) == NULL);
+    char *whole = n_malloc(4 * PGSIZE);
+    assert(whole != NULL);
+    assert(n_fork(whole + 100, 2 * PGSIZE) == NULL);
+    n_free(whole, 4 * PGSIZE);
+    n_free(small, 100);
+    n_free(small_copy, 100);
+    printf("Forks share frames until written, and free independently\n");
+}
+
+void test_fork_large() {
+    printf("\n=== Testing n_fork of Superpages and Reservations ===\n");
+    set_physical_mem();
+
+    // A superpage is split into 4 KB pages, which are then shared
+    char *va = n_malloc(LARGE_PAGE_SIZE);
+    assert(va != NULL);
+    assert(page_directory[GET_PAGE_DIR_INDEX(va)] & PDE_LARGE);
+    unsigned int pages = LARGE_PAGE_SIZE / PGSIZE;
+    stamp(va, pages, 0);
+    char *copy = n_fork(va, LARGE_PAGE_SIZE);
+    assert(copy != NULL);
+    assert(!(page_directory[GET_PAGE_DIR_INDEX(va)] & PDE_LARGE));
+    assert(frame_of(va + 77 * PGSIZE) == frame_of(copy + 77 * PGSIZE));
+    check_stamp(copy, pages, 0);
+    stamp(copy, pages, 5000);
+    check_stamp(va, pages, 0);
+    check_stamp(copy, pages, 5000);
+    n_free(va, LARGE_PAGE_SIZE);
+    n_free(copy, LARGE_PAGE_SIZE);
+
+    // Untouched demand-paged pages fault in separately, zeroed, on each side
+    set_demand_paging(1);
+    char *lazy = n_malloc(PAGES * PGSIZE);
+    assert(lazy != NULL);
+    unsigned int v = 42;
+    assert(put_data(lazy, &v, sizeof(v)) == 0);
+    char *lazy_copy = n_fork(lazy, PAGES * PGSIZE);
+    assert(lazy_copy != NULL);
+    get_data(lazy_copy, &v, sizeof(v));
+    assert(v == 42);
+    get_data(lazy_copy + 9 * PGSIZE, &v, sizeof(v));
+    assert(v == 0);
+    v = 9;
+    assert(put_data(lazy + 9 * PGSIZE, &v, sizeof(v)) == 0);
+    get_data(lazy_copy + 9 * PGSIZE, &v, sizeof(v));
+    assert(v == 0);
+    n_free(lazy, PAGES * PGSIZE);
+    n_free(lazy_copy, PAGES * PGSIZE);
+    set_demand_paging(0);
+    printf("Superpages split and reservations stay private\n");
+}
+
+#define FORK_THREADS 4
+#define FORK_ROUNDS 200
+
+struct fork_arg {
+    char *va;
+    unsigned int tag;
+};
+
+// Each thread writes its own words of every page, racing the COW breaks
+static void *fork_writer(void *arg) {
+    struct fork_arg *fa = (struct fork_arg *)arg;
+    for (unsigned int r = 0; r < FORK_ROUNDS; r++) {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            unsigned int v = fa->tag + r;
+            assert(put_data(fa->va + i * PGSIZE + 64 + 4 * (fa->tag % FORK_THREADS), &v, sizeof(v)) == 0);
+        }
+    }
+    return NULL;
+}
+
+void test_fork_concurrent() {
+    printf("\n=== Testing Concurrent Copy-on-Write ===\n");
+    set_physical_mem();
+
+    // Writers on both sides of a fresh fork break the sharing at once;
+    // every write lands on its own side
+    char *va = n_malloc(PAGES * PGSIZE);
+    assert(va != NULL);
+    stamp(va, PAGES, 0);
+    char *copy = n_fork(va, PAGES * PGSIZE);
+    assert(copy != NULL);
+
+    pthread_t th[FORK_THREADS];
+    struct fork_arg args[FORK_THREADS];
+    for (int t = 0; t < FORK_THREADS; t++) {
+        args[t].va = t % 2 ? copy : va;
+        args[t].tag = (t % 2 ? 0x20000 : 0x10000) + t;
+        pthread_create(&th[t], NULL, fork_writer, &args[t]);
+    }
+    for (int t = 0; t < FORK_THREADS; t++) pthread_join(th[t], NULL);
+
+    for (int t = 0; t < FORK_THREADS; t++) {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            unsigned int v = 0;
+            get_data(args[t].va + i * PGSIZE + 64 + 4 * t, &v, sizeof(v));
+            assert(v == args[t].tag + FORK_ROUNDS - 1);
+            char *other = args[t].va == va ? copy : va;
+            get_data(other + i * PGSIZE + 64 + 4 * t, &v, sizeof(v));
+            assert(v == 0);
+        }
+    }
+    check_stamp(va, PAGES, 0);
+    check_stamp(copy, PAGES, 0);
+    assert(frame_of(va) != frame_of(copy));
+    n_free(va, PAGES * PGSIZE);
+    n_free(copy, PAGES * PGSIZE);
+    printf("Racing writers each keep their own copy\n");
+}
+
+#define SWAP_CHUNK 64
+
+// Runs last: it leaves swap on
+void test_fork_swap() {
+    printf("\n=== Testing n_fork with Swap ===\n");
+    set_physical_mem();
+    assert(set_swap("/tmp/vm_fork_swap_test", 16384) == 0);
+
+    // Push a stamped range out to swap by filling RAM behind it
+    char *va = n_malloc(PAGES * PGSIZE);
+    assert(va != NULL);
+    stamp(va, PAGES, 0);
+    static char *chunk[TOTAL_PHYSICAL_PAGES / SWAP_CHUNK + 1];
+    int nchunks = 0;
+    while (nchunks <= TOTAL_PHYSICAL_PAGES / SWAP_CHUNK &&
+           (chunk[nchunks] = n_malloc(SWAP_CHUNK * PGSIZE)) != NULL) {
+        stamp(chunk[nchunks], SWAP_CHUNK, 0x1000000 + nchunks * SWAP_CHUNK);
+        nchunks++;
+    }
+    assert(nchunks > TOTAL_PHYSICAL_PAGES / SWAP_CHUNK);
+    unsigned long slots = swap_store.free_slots;
+
+    // Swapped-out pages fork as copies of their slots, which a free of
+    // the fork gives back
+    char *copy = n_fork(va, PAGES * PGSIZE);
+    assert(copy != NULL);
+    assert(slots - swap_store.free_slots == PAGES);
+    n_free(copy, PAGES * PGSIZE);
+    assert(swap_store.free_slots == slots);
+
+    // Each side reads its pages back and writes its own copies
+    copy = n_fork(va, PAGES * PGSIZE);
+    assert(copy != NULL);
+    unsigned long long faults = major_faults;
+    check_stamp(copy, PAGES, 0);
+    assert(major_faults - faults >= PAGES);
+    stamp(copy, PAGES, 100);
+    check_stamp(va, PAGES, 0);
+    check_stamp(copy, PAGES, 100);
+
+    for (int i = 0; i < nchunks; i++) n_free(chunk[i], SWAP_CHUNK * PGSIZE);
+    n_free(va, PAGES * PGSIZE);
+    n_free(copy, PAGES * PGSIZE);
+    printf("Forks of swapped-out pages read back intact\n");
+}
+
+int main() {
+    printf("Starting copy-on-write tests...\n");
+
+    test_fork();
+    test_fork_large();
+    test_fork_concurrent();
+    test_fork_swap();
+
+    printf("\nAll copy-on-write tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../my_vm.h"
+#include "../pool.h"
+#include "test_util.h"
+
+static int next_small() {
+    return (int)(next_rand() % 201) - 100;
+}
+
+// C += A * B the textbook way, as the reference
+static void naive_gemm(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++) {
+            int sum = 0;
+            for (int p = 0; p < k; p++) sum += a[i * lda + p] * b[p * ldb + j];
+            c[i * ldc + j] += sum;
+        }
+}
+
+void test_gemm_kernel() {
+    printf("\n=== Testing Host GEMM Kernel ===\n");
+
+    // Shapes off every block size, with padded row strides
+    int shapes[][3] = { { 1, 1, 1 }, { 3, 5, 7 }, { 8, 8, 8 }, { 17, 33, 9 },
+                        { 64, 31, 65 }, { 128, 256, 128 }, { 129, 257, 3 } };
+    for (int s = 0; s < 7; s++) {
+        int m = shapes[s][0], n = shapes[s][1], k = shapes[s][2];
+        int lda = k + 3, ldb = n + 5, ldc = n + 1;
+        int *a = malloc(m * lda * sizeof(int));
+        int *b = malloc(k * ldb * sizeof(int));
+        int *c = malloc(m * ldc * sizeof(int));
+        int *ref = malloc(m * ldc * sizeof(int));
+        assert(a && b && c && ref);
+        for (int i = 0; i < m * lda; i++) a[i] = next_small();
+        for (int i = 0; i < k * ldb; i++) b[i] = next_small();
+        for (int i = 0; i < m * ldc; i++) c[i] = ref[i] = next_small();
+
+        gemm_i32(m, n, k, a, lda, b, ldb, c, ldc);
+        naive_gemm(m, n, k, a, lda, b, ldb, ref, ldc);
+        assert(memcmp(c, ref, m * ldc * sizeof(int)) == 0);
+        free(a);
+        free(b);
+        free(c);
+        free(ref);
+    }
+    printf("Kernel accumulates exactly as the naive loop\n");
+}
+
+// Fill size x size matrices in virtual memory and their host copies
+static void load(int size, void **a, void **b, void **c, int **ha, int **hb) {
+    unsigned int bytes = size * size * sizeof(int);
+    *a = n_malloc(bytes);
+    *b = n_malloc(bytes);
+    *c = n_malloc(bytes);
+    *ha = malloc(bytes);
+    *hb = malloc(bytes);
+    assert(*a && *b && *c && *ha && *hb);
+    for (int i = 0; i < size * size; i++) {
+        (*ha)[i] = next_small();
+        (*hb)[i] = next_small();
+    }
+    assert(put_data(*a, *ha, bytes) == 0);
+    assert(put_data(*b, *hb, bytes) == 0);
+}
+
+// The answer in virtual memory must equal the naive product
+static void check_product(int size, void *c, const int *ha, const int *hb) {
+    unsigned int bytes = size * size * sizeof(int);
+    int *got = malloc(bytes), *want = calloc(size * size, sizeof(int));
+    assert(got && want);
+    get_data(c, got, bytes);
+    naive_gemm(size, size, size, ha, size, hb, size, want, size);
+    assert(memcmp(got, want, bytes) == 0);
+    free(got);
+    free(want);
+}
+
+static void release(int size, void *a, void *b, void *c, int *ha, int *hb) {
+    unsigned int bytes = size * size * sizeof(int);
+    n_free(a, bytes);
+    n_free(b, bytes);
+    n_free(c, bytes);
+    free(ha);
+    free(hb);
+}
+
+void test_mat_mult() {
+    printf("\n=== Testing mat_mult ===\n");
+    set_physical_mem();
+
+    // Sizes below, at and across tile and page boundaries
+    int sizes[] = { 1, 2, 7, 100, 128, 129, 256, 300 };
+    for (int s = 0; s < 8; s++) {
+        void *a, *b, *c;
+        int *ha, *hb;
+        load(sizes[s], &a, &b, &c, &ha, &hb);
+        mat_mult(a, b, sizes[s], c);
+        check_product(sizes[s], c, ha, hb);
+
+        // The answer is overwritten, not accumulated into
+        mat_mult(a, b, sizes[s], c);
+        check_product(sizes[s], c, ha, hb);
+        release(sizes[s], a, b, c, ha, hb);
+    }
+    printf("Tiled products match the naive product\n");
+}
+
+#define POOL_TASKS 1000
+
+struct pool_check {
+    int runs[POOL_TASKS];
+    int by_worker[POOL_MAX_WORKERS];
+};
+
+// Uneven work, so the fast workers have something to steal
+static void pool_task(void *arg, int task, int worker) {
+    struct pool_check *pc = (struct pool_check *)arg;
+    volatile unsigned int spin = 0;
+    for (int i = 0; i < (task < POOL_TASKS / 8 ? 20000 : 100); i++) spin += i;
+    __atomic_fetch_add(&pc->runs[task], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pc->by_worker[worker], 1, __ATOMIC_RELAXED);
+}
+
+void test_pool() {
+    printf("\n=== Testing Work-Stealing Pool ===\n");
+    static struct task_pool pool = TASK_POOL_INITIALIZER;
+    static struct pool_check pc;
+
+    // Every task runs exactly once, job after job, whatever the worker count
+    int workers[] = { 1, 3, 8, 3 };
+    for (int w = 0; w < 4; w++) {
+        memset(&pc, 0, sizeof(pc));
+        assert(pool_run(&pool, workers[w], POOL_TASKS, pool_task, &pc) == 0);
+        int total = 0;
+        for (int t = 0; t < POOL_TASKS; t++) assert(pc.runs[t] == 1);
+        for (int i = 0; i < POOL_MAX_WORKERS; i++) {
+            assert(i < workers[w] || pc.by_worker[i] == 0);
+            total += pc.by_worker[i];
+        }
+        assert(total == POOL_TASKS);
+    }
+
+    // Fewer tasks than workers, and none at all
+    memset(&pc, 0, sizeof(pc));
+    assert(pool_run(&pool, 8, 3, pool_task, &pc) == 0);
+    assert(pc.runs[0] == 1 && pc.runs[1] == 1 && pc.runs[2] == 1 && pc.runs[3] == 0);
+    assert(pool_run(&pool, 4, 0, pool_task, &pc) == 0);
+    printf("Each task ran once on a worker of its job\n");
+}
+
+void test_mat_mult_parallel() {
+    printf("\n=== Testing mat_mult_parallel ===\n");
+    set_physical_mem();
+
+    int sizes[] = { 1, 100, 257, 512 };
+    int threads[] = { 4, 3, 8, 0 };
+    for (int s = 0; s < 4; s++) {
+        void *a, *b, *c;
+        int *ha, *hb;
+        load(sizes[s], &a, &b, &c, &ha, &hb);
+        mat_mult_parallel(a, b, sizes[s], c, threads[s]);
+        check_product(sizes[s], c, ha, hb);
+        release(sizes[s], a, b, c, ha, hb);
+    }
+
+    // From a thread in another space: the workers must translate there
+    struct vm_space *space = vm_space_create();
+    assert(space != NULL);
+    struct vm_space *prev = vm_space_switch(space);
+    for (int s = 1; s < 3; s++) {
+        void *a, *b, *c;
+        int *ha, *hb;
+        load(sizes[s], &a, &b, &c, &ha, &hb);
+        mat_mult_parallel(a, b, sizes[s], c, 4);
+        check_product(sizes[s], c, ha, hb);
+        release(sizes[s], a, b, c, ha, hb);
+    }
+    assert(vm_space_switch(prev) == space);
+    assert(vm_space_destroy(space) == 0);
+    printf("Parallel products match, in any address space\n");
+}
+
+int main() {
+    printf("Starting matrix multiply tests...\n");
+
+    test_gemm_kernel();
+    test_mat_mult();
+    test_pool();
+    test_mat_mult_parallel();
+
+    printf("\nAll matrix multiply tests passed!\n");
+    return 0;
+}
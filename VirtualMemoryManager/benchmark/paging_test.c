@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+// Fault counters kept by the library
+extern unsigned long long demand_faults;
+extern unsigned long long major_faults;
+
+void test_demand_paging() {
+    printf("\n=== Testing Demand Paging ===\n");
+    set_physical_mem();
+    set_demand_paging(1);
+
+    // A big sparse buffer takes page tables, not frames
+    unsigned int pages = 64 * 1024;
+    unsigned int before = frame_pool.free_frames;
+    char *big = n_malloc(pages * PGSIZE);
+    assert(big != NULL);
+    assert(before - frame_pool.free_frames < pages / 16);
+    pte_t *pt_entry = translate(page_directory, big + 123 * PGSIZE);
+    assert(pt_entry != NULL);
+
+    // First touches fault in zeroed frames, one per page
+    unsigned long long faults = demand_faults;
+    for (unsigned int i = 0; i < pages; i += 4099) {
+        int v = -1;
+        get_data(big + i * PGSIZE + 100, &v, sizeof(v));
+        assert(v == 0);
+        v = (int)i;
+        assert(put_data(big + i * PGSIZE + 100, &v, sizeof(v)) == 0);
+    }
+    unsigned long long touched = demand_faults - faults;
+    assert(touched >= (pages + 4098) / 4099 - 1 && touched <= (pages + 4098) / 4099 + 1);
+    for (unsigned int i = 0; i < pages; i += 4099) {
+        int v = -1;
+        get_data(big + i * PGSIZE + 100, &v, sizeof(v));
+        assert(v == (int)i);
+    }
+
+    // A write that spans an untouched page boundary faults in both pages
+    faults = demand_faults;
+    char buf[64];
+    memset(buf, 7, sizeof(buf));
+    assert(put_data(big + 10 * PGSIZE - 32, buf, sizeof(buf)) == 0);
+    assert(demand_faults - faults == 2);
+
+    // Freeing gives back the reservations and the frames that were touched
+    n_free(big, pages * PGSIZE);
+    char *again = n_malloc(pages * PGSIZE);
+    assert(again != NULL);
+    n_free(again, pages * PGSIZE);
+
+    set_demand_paging(0);
+    printf("Reservations cost no frames until touched\n");
+}
+
+void test_superpages() {
+    printf("\n=== Testing Superpages ===\n");
+    set_physical_mem();
+
+    // A 12 MB request is 4 MB aligned, with one large PDE per whole 4 MB
+    unsigned int size = 3 * LARGE_PAGE_SIZE;
+    char *va = n_malloc(size);
+    assert(va != NULL);
+    assert(GET_VPN(va) % LARGE_PAGE_FRAMES == 0);
+    for (int i = 0; i < 3; i++) {
+        pde_t pde = page_directory[GET_PAGE_DIR_INDEX(va + i * LARGE_PAGE_SIZE)];
+        assert((pde & 0x1) && (pde & PDE_LARGE));
+    }
+
+    // Each superpage maps one contiguous run of frames
+    char *base = (char *)translate(page_directory, va);
+    for (unsigned long j = 0; j < LARGE_PAGE_FRAMES; j += 97) {
+        assert((char *)translate(page_directory, va + j * PGSIZE + 5) == base + j * PGSIZE + 5);
+    }
+    unsigned int pages = size / PGSIZE;
+    for (unsigned int i = 0; i < pages; i++) {
+        assert(put_data(va + i * PGSIZE + 12, &i, sizeof(i)) == 0);
+    }
+
+    // Translations go in the large TLB: one entry covers a whole 4 MB
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int v = ~0u;
+        get_data(va + i * PGSIZE + 12, &v, sizeof(v));
+        assert(v == i);
+    }
+    for (int i = 0; i < 3; i++) {
+        unsigned long ppn = 0;
+        unsigned long vpn = GET_VPN(va + i * LARGE_PAGE_SIZE);
+        assert(tlb_lookup(&tlb_large, 0, vpn >> LARGE_PAGE_ORDER, &ppn));
+        assert((char *)physical_memory + (ppn << OFFSET_BITS) ==
+               (char *)translate(page_directory, va + i * LARGE_PAGE_SIZE));
+    }
+
+    // Freeing part of a superpage splits it: the freed pages go, the rest
+    // keep their data, and the freed range comes back unmapped
+    char *hole = va + LARGE_PAGE_SIZE + 100 * PGSIZE;
+    n_free(hole, 300 * PGSIZE);
+    pde_t pde = page_directory[GET_PAGE_DIR_INDEX(hole)];
+    assert((pde & 0x1) && !(pde & PDE_LARGE));
+    assert(translate(page_directory, hole) == NULL);
+    assert(translate(page_directory, hole + 299 * PGSIZE) == NULL);
+    unsigned int v = 0;
+    assert(put_data(hole, &v, sizeof(v)) == -1);
+    for (unsigned int i = 0; i < pages; i += 7) {
+        if (va + i * PGSIZE >= hole && va + i * PGSIZE < hole + 300 * PGSIZE) continue;
+        v = ~0u;
+        get_data(va + i * PGSIZE + 12, &v, sizeof(v));
+        assert(v == i);
+    }
+
+    // Whoever gets the freed range next doesn't share the old frames
+    char *reuse = n_malloc(300 * PGSIZE);
+    assert(reuse != NULL);
+    for (unsigned int i = 0; i < 300; i++) {
+        unsigned int mark = 0xdeadbeef;
+        assert(put_data(reuse + i * PGSIZE + 12, &mark, sizeof(mark)) == 0);
+    }
+    for (unsigned int i = 0; i < pages; i++) {
+        if (va + i * PGSIZE >= hole && va + i * PGSIZE < hole + 300 * PGSIZE) continue;
+        v = ~0u;
+        get_data(va + i * PGSIZE + 12, &v, sizeof(v));
+        assert(v == i);
+    }
+    n_free(reuse, 300 * PGSIZE);
+
+    // The pieces on either side free normally
+    n_free(va, LARGE_PAGE_SIZE + 100 * PGSIZE);
+    n_free(hole + 300 * PGSIZE, size - LARGE_PAGE_SIZE - 400 * PGSIZE);
+    assert(translate(page_directory, va) == NULL);
+    assert(translate(page_directory, va + size - PGSIZE) == NULL);
+
+    // A threshold of 0 turns superpages off
+    set_superpage_threshold(0);
+    char *flat = n_malloc(2 * LARGE_PAGE_SIZE);
+    assert(flat != NULL);
+    for (int i = 0; i < 2; i++) {
+        pde = page_directory[GET_PAGE_DIR_INDEX(flat + i * LARGE_PAGE_SIZE)];
+        assert(!(pde & PDE_LARGE));
+    }
+    n_free(flat, 2 * LARGE_PAGE_SIZE);
+    set_superpage_threshold(LARGE_PAGE_SIZE);
+    printf("Large PDEs map, translate, split and free correctly\n");
+}
+
+void test_swap_area() {
+    printf("\n=== Testing Swap Area ===\n");
+    struct swap_area a = { .fd = -1 };
+
+    // Slots past 2 GB into the file must not wrap
+    unsigned long nslots = (1UL << 19) + 16;
+    assert(swap_open(&a, "/tmp/vm_swap_area_test", nslots, PGSIZE) == 0);
+    assert(a.free_slots == nslots);
+    char out[PGSIZE], in[PGSIZE];
+    unsigned long slots[] = { 0, 1, (1UL << 19) - 1, 1UL << 19, nslots - 1 };
+    for (int i = 0; i < 5; i++) {
+        memset(out, 'a' + i, PGSIZE);
+        assert(swap_write(&a, slots[i], out) == 0);
+    }
+    for (int i = 0; i < 5; i++) {
+        assert(swap_read(&a, slots[i], in) == 0);
+        for (int j = 0; j < PGSIZE; j += 256) assert(in[j] == 'a' + i);
+    }
+    assert(a.reads == 5 && a.writes == 5);
+
+    // Slots come out in order and are reused once freed
+    long s0 = swap_alloc(&a);
+    long s1 = swap_alloc(&a);
+    assert(s0 >= 0 && s1 == s0 + 1 && a.free_slots == nslots - 2);
+    swap_free(&a, s0);
+    swap_free(&a, s1);
+    assert(a.free_slots == nslots);
+    swap_close(&a);
+    printf("Slot I/O is correct across the whole area\n");
+}
+
+#define SWAP_CHUNK 64
+
+// Runs last: it leaves swap on
+void test_swap() {
+    printf("\n=== Testing Swap ===\n");
+    set_physical_mem();
+
+    // Fill RAM with stamped pages until allocation fails
+    static char *chunk[TOTAL_PHYSICAL_PAGES / SWAP_CHUNK];
+    int nchunks = 0;
+    while (nchunks < TOTAL_PHYSICAL_PAGES / SWAP_CHUNK &&
+           (chunk[nchunks] = n_malloc(SWAP_CHUNK * PGSIZE)) != NULL) {
+        stamp(chunk[nchunks], SWAP_CHUNK, nchunks * SWAP_CHUNK);
+        nchunks++;
+    }
+    assert(nchunks > TOTAL_PHYSICAL_PAGES / SWAP_CHUNK / 2);
+    assert(n_malloc(SWAP_CHUNK * PGSIZE) == NULL);
+
+    // With swap on the same request succeeds by evicting the oldest pages
+    assert(set_swap("/tmp/vm_swap_test", 16384) == 0);
+    assert(set_swap("/tmp/vm_swap_test", 16384) == -1);
+    unsigned long long writes = swap_store.writes;
+    char *more = n_malloc(1024 * PGSIZE);
+    assert(more != NULL);
+    stamp(more, 1024, 0x40000000);
+    assert(swap_store.writes - writes >= 1024 - SWAP_CHUNK);
+    assert(swap_store.free_slots < swap_store.nslots);
+
+    // Evicted pages come back intact on access, each a major fault
+    unsigned long long faults = major_faults;
+    check_stamp(chunk[0], SWAP_CHUNK, 0);
+    assert(major_faults - faults >= SWAP_CHUNK / 2);
+    check_stamp(more, 1024, 0x40000000);
+
+    // Freeing swapped-out pages gives their slots back
+    for (int i = 0; i < nchunks; i++) n_free(chunk[i], SWAP_CHUNK * PGSIZE);
+    n_free(more, 1024 * PGSIZE);
+    assert(swap_store.free_slots == swap_store.nslots);
+
+    // Large requests stay on 4 KB pages even with 4 MB blocks free, so
+    // they can be evicted too
+    char *large = n_malloc(8 * 1024 * 1024);
+    assert(large != NULL);
+    for (int i = 0; i < 8 * 1024 * 1024 / (4 << 20); i++) {
+        pde_t pde = page_directory[GET_PAGE_DIR_INDEX(large + i * (4 << 20))];
+        assert(!(pde & PDE_LARGE));
+    }
+    stamp(large, 8 * 1024 * 1024 / PGSIZE, 0x50000000);
+    check_stamp(large, 8 * 1024 * 1024 / PGSIZE, 0x50000000);
+    n_free(large, 8 * 1024 * 1024);
+    print_fault_stats();
+    printf("Working sets larger than RAM page through swap\n");
+}
+
+int main() {
+    printf("Starting paging tests...\n");
+
+    test_demand_paging();
+    test_superpages();
+    test_swap_area();
+    test_swap();
+
+    printf("\nAll paging tests passed!\n");
+    return 0;
+}
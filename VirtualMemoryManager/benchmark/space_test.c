@@ -0,0 +1,283 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+#define PAGES 32
+
+void test_space_isolation() {
+    printf("\n=== Testing Address-Space Isolation ===\n");
+    set_physical_mem();
+
+    // Spaces hand out the same addresses, each over frames of its own
+    struct vm_space *a = vm_space_create();
+    struct vm_space *b = vm_space_create();
+    assert(a && b && a != b);
+    struct vm_space *prev = vm_space_switch(a);
+    char *va = n_malloc(PAGES * PGSIZE);
+    assert(va != NULL);
+    stamp(va, PAGES, 1000);
+    vm_space_switch(b);
+    char *vb = n_malloc(PAGES * PGSIZE);
+    assert(vb == va);
+    stamp(vb, PAGES, 2000);
+
+    // Switching back and forth keeps each space's view: the TLB holds
+    // both at once under different ASIDs
+    for (int round = 0; round < 4; round++) {
+        vm_space_switch(a);
+        check_stamp(va, PAGES, 1000);
+        vm_space_switch(b);
+        check_stamp(vb, PAGES, 2000);
+    }
+
+    // A page allocated in one space is unmapped in the other
+    vm_space_switch(a);
+    char *only_a = n_malloc(PGSIZE);
+    assert(only_a != NULL);
+    vm_space_switch(b);
+    unsigned int v = 7;
+    assert(put_data(only_a, &v, sizeof(v)) == -1);
+
+    // map_page only installs into the current space's directory, whose
+    // ASID the frame's owner tag names
+    vm_space_switch(prev);
+    set_demand_paging(1);
+    char *home = n_malloc(PGSIZE);
+    set_demand_paging(0);
+    void *pa = get_next_avail(1);
+    assert(home && pa);
+    vm_space_switch(b);
+    assert(map_page(page_directory, home, pa) == -1);
+    vm_space_switch(prev);
+    assert(map_page(page_directory, home, pa) == 0);
+    assert((void *)translate(page_directory, home) == pa);
+    n_free(home, PGSIZE);
+    vm_space_switch(b);
+
+    // A current space can't be destroyed, nor can the default one
+    assert(vm_space_destroy(b) == -1);
+    vm_space_switch(prev);
+    assert(vm_space_current() == prev);
+    assert(vm_space_destroy(b) == 0);
+    assert(vm_space_destroy(prev) == -1);
+    assert(vm_space_destroy(NULL) == -1);
+
+    // Freeing in one space leaves the other's pages alone
+    vm_space_switch(a);
+    check_stamp(va, PAGES, 1000);
+    n_free(only_a, PGSIZE);
+    n_free(va, PAGES * PGSIZE);
+    vm_space_switch(prev);
+    assert(vm_space_destroy(a) == 0);
+    printf("Each space sees only its own pages\n");
+}
+
+void test_space_reuse() {
+    printf("\n=== Testing ASID Reuse ===\n");
+    set_physical_mem();
+
+    // A default-space page with its translation cached
+    char *mine = n_malloc(PGSIZE);
+    assert(mine != NULL);
+    unsigned int v = 0x5EED;
+    assert(put_data(mine, &v, sizeof(v)) == 0);
+    unsigned long ppn;
+    assert(tlb_lookup(&tlb_store, 0, GET_VPN(mine), &ppn));
+
+    // Destroy a space with its pages still cached, over and over; a new
+    // space on the same ASID and addresses must never see them
+    for (int round = 0; round < 50; round++) {
+        struct vm_space *s = vm_space_create();
+        assert(s != NULL);
+        struct vm_space *prev = vm_space_switch(s);
+        char *va = n_malloc(PAGES * PGSIZE);
+        assert(va != NULL);
+        for (unsigned int i = 0; i < PAGES; i++) {
+            v = ~0u;
+            get_data(va + i * PGSIZE, &v, sizeof(v));
+            assert(v == 0);
+        }
+        stamp(va, PAGES, round * PAGES);
+        check_stamp(va, PAGES, round * PAGES);
+        vm_space_switch(prev);
+        assert(vm_space_destroy(s) == 0);
+    }
+
+    // None of that flushed the default space
+    assert(tlb_lookup(&tlb_store, 0, GET_VPN(mine), &ppn));
+    get_data(mine, &v, sizeof(v));
+    assert(v == 0x5EED);
+    n_free(mine, PGSIZE);
+    printf("Reused ASIDs start with nothing cached\n");
+}
+
+void test_space_limit() {
+    printf("\n=== Testing Address-Space Limit ===\n");
+    set_physical_mem();
+
+    // Every ASID but the default space's, then no more
+    static struct vm_space *spaces[VM_MAX_SPACES];
+    int n = 0;
+    while (n < VM_MAX_SPACES && (spaces[n] = vm_space_create()) != NULL) n++;
+    assert(n == VM_MAX_SPACES - 1);
+    assert(vm_space_create() == NULL);
+
+    // The last one works like any other
+    struct vm_space *prev = vm_space_switch(spaces[n - 1]);
+    char *va = n_malloc(PAGES * PGSIZE);
+    assert(va != NULL);
+    stamp(va, PAGES, 77);
+    check_stamp(va, PAGES, 77);
+    n_free(va, PAGES * PGSIZE);
+    vm_space_switch(prev);
+
+    // Destroying one frees its ASID for the next create
+    assert(vm_space_destroy(spaces[10]) == 0);
+    spaces[10] = vm_space_create();
+    assert(spaces[10] != NULL);
+    assert(vm_space_create() == NULL);
+    for (int i = 0; i < n; i++) assert(vm_space_destroy(spaces[i]) == 0);
+    printf("%d spaces fit alongside the default one\n", n);
+}
+
+#define MAP_THREADS 8
+#define MAP_ROUNDS 400
+#define MAP_LIVE 4
+
+struct map_arg {
+    struct vm_space *space;
+    unsigned int tag;
+    unsigned int rng;
+};
+
+// Allocate, stamp, check and free ranges of random length, a few live at
+// once. Ranges of different threads share page tables, so table installs
+// and unmaps race all the time.
+static void *map_worker(void *arg) {
+    struct map_arg *ma = (struct map_arg *)arg;
+    struct vm_space *prev = vm_space_switch(ma->space);
+    char *live[MAP_LIVE] = { NULL };
+    unsigned int pages[MAP_LIVE] = { 0 };
+
+    for (unsigned int r = 0; r < MAP_ROUNDS; r++) {
+        int k = r % MAP_LIVE;
+        if (live[k]) {
+            check_stamp(live[k], pages[k], (ma->tag << 20) + (r - MAP_LIVE) * 64);
+            n_free(live[k], pages[k] * PGSIZE);
+        }
+        pages[k] = xorshift32(&ma->rng) % 48 + 1;
+        live[k] = n_malloc(pages[k] * PGSIZE);
+        assert(live[k] != NULL);
+        stamp(live[k], pages[k], (ma->tag << 20) + r * 64);
+    }
+    for (unsigned int r = MAP_ROUNDS - MAP_LIVE; r < MAP_ROUNDS; r++) {
+        int k = r % MAP_LIVE;
+        check_stamp(live[k], pages[k], (ma->tag << 20) + r * 64);
+        n_free(live[k], pages[k] * PGSIZE);
+    }
+    vm_space_switch(prev);
+    return NULL;
+}
+
+void test_concurrent_map_unmap() {
+    printf("\n=== Testing Concurrent Map / Unmap ===\n");
+    set_physical_mem();
+
+    // Most threads in the default space, two sharing another one
+    struct vm_space *other = vm_space_create();
+    assert(other != NULL);
+    pthread_t th[MAP_THREADS];
+    struct map_arg args[MAP_THREADS];
+    for (int t = 0; t < MAP_THREADS; t++) {
+        args[t].space = t < 2 ? other : NULL;
+        args[t].tag = t + 1;
+        args[t].rng = RNG_SEED + t;
+        pthread_create(&th[t], NULL, map_worker, &args[t]);
+    }
+    for (int t = 0; t < MAP_THREADS; t++) pthread_join(th[t], NULL);
+    assert(vm_space_destroy(other) == 0);
+    printf("No mapping lost across %d threads\n", MAP_THREADS);
+}
+
+#define RACE_PAGES 64
+
+struct race_arg {
+    char *range;
+    int thread;
+    int won[RACE_PAGES];
+    void *frame[RACE_PAGES];
+};
+
+static pthread_barrier_t race_barrier;
+
+// Every thread maps its own frame at the same page; a loser puts its
+// frame at a page of its own instead, so every frame stays accounted for
+static void *race_worker(void *arg) {
+    struct race_arg *ra = (struct race_arg *)arg;
+    for (int i = 0; i < RACE_PAGES; i++) {
+        void *pa = get_next_avail(1);
+        assert(pa != NULL);
+        ra->frame[i] = pa;
+        pthread_barrier_wait(&race_barrier);
+        ra->won[i] = map_page(page_directory, ra->range + i * PGSIZE, pa) == 0;
+        if (!ra->won[i]) {
+            char *own = ra->range + (RACE_PAGES * (ra->thread + 1) + i) * PGSIZE;
+            assert(map_page(page_directory, own, pa) == 0);
+        }
+    }
+    return NULL;
+}
+
+void test_map_race() {
+    printf("\n=== Testing Racing map_page ===\n");
+    set_physical_mem();
+
+    // Reserved pages, mapped by hand below
+    set_demand_paging(1);
+    unsigned int pages = RACE_PAGES * (MAP_THREADS + 1);
+    char *range = n_malloc(pages * PGSIZE);
+    assert(range != NULL);
+    set_demand_paging(0);
+
+    static struct race_arg args[MAP_THREADS];
+    pthread_t th[MAP_THREADS];
+    pthread_barrier_init(&race_barrier, NULL, MAP_THREADS);
+    for (int t = 0; t < MAP_THREADS; t++) {
+        args[t].range = range;
+        args[t].thread = t;
+        pthread_create(&th[t], NULL, race_worker, &args[t]);
+    }
+    for (int t = 0; t < MAP_THREADS; t++) pthread_join(th[t], NULL);
+    pthread_barrier_destroy(&race_barrier);
+
+    // One winner per page, whose frame is the one mapped
+    for (int i = 0; i < RACE_PAGES; i++) {
+        int winners = 0;
+        for (int t = 0; t < MAP_THREADS; t++) {
+            char *va = args[t].won[i] ? range + i * PGSIZE
+                                      : range + (RACE_PAGES * (t + 1) + i) * PGSIZE;
+            assert((void *)translate(page_directory, va) == args[t].frame[i]);
+            winners += args[t].won[i];
+        }
+        assert(winners == 1);
+    }
+    n_free(range, pages * PGSIZE);
+    printf("Exactly one mapper won each page\n");
+}
+
+int main() {
+    printf("Starting address-space tests...\n");
+
+    test_space_isolation();
+    test_space_reuse();
+    test_space_limit();
+    test_concurrent_map_unmap();
+    test_map_race();
+
+    printf("\nAll address-space tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef TEST_UTIL_H_INCLUDED
+#define TEST_UTIL_H_INCLUDED
+
+// Fixtures shared by the check programs: a deterministic random source
+// and per-page stamps for telling whether a range kept its data.
+
+#include <assert.h>
+#include "../my_vm.h"
+
+#define RNG_SEED 2463534242u
+
+// One xorshift32 step on a caller-owned state, for per-thread streams
+static inline unsigned int xorshift32(unsigned int *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+// The program-wide stream, the same sequence on every run
+static inline unsigned int next_rand(void) {
+    static unsigned int rng = RNG_SEED;
+    return xorshift32(&rng);
+}
+
+// Stamp each page of a range with its own number
+static inline void stamp(char *va, unsigned int pages, unsigned int first) {
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int v = first + i;
+        assert(put_data(va + i * PGSIZE, &v, sizeof(v)) == 0);
+    }
+}
+
+static inline void check_stamp(char *va, unsigned int pages, unsigned int first) {
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int v = ~0u;
+        get_data(va + i * PGSIZE, &v, sizeof(v));
+        assert(v == first + i);
+    }
+}
+
+#endif
@@ -0,0 +1,359 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "../my_vm.h"
+#include "test_util.h"
+
+void test_tlb_geometry() {
+    printf("\n=== Testing TLB Geometry ===\n");
+    struct tlb t;
+
+    // Sets must be a power of two and ways must divide the entries
+    assert(tlb_init(&t, 48, 4, TLB_POLICY_LRU) == -1);
+    assert(tlb_init(&t, 64, 3, TLB_POLICY_LRU) == -1);
+    assert(tlb_init(&t, 4, 8, TLB_POLICY_LRU) == -1);
+    assert(tlb_init(&t, 0, 1, TLB_POLICY_LRU) == -1);
+    assert(tlb_init(&t, 64, 4, 7) == -1);
+
+    assert(tlb_init(&t, 64, 4, TLB_POLICY_CLOCK) == 0);
+    assert(t.sets == 16 && t.ways == 4);
+    tlb_destroy(&t);
+
+    // Fully associative: one set
+    assert(tlb_init(&t, 16, 16, TLB_POLICY_LRU) == 0);
+    assert(t.sets == 1);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) tlb_insert(&t, 0, vpn * 97, vpn);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) {
+        unsigned long ppn;
+        assert(tlb_lookup(&t, 0, vpn * 97, &ppn) && ppn == vpn);
+    }
+    tlb_destroy(&t);
+    printf("Geometry checks passed\n");
+}
+
+void test_tlb_lru() {
+    printf("\n=== Testing LRU Replacement ===\n");
+    struct tlb t;
+    unsigned long ppn;
+
+    // 4 sets of 2 ways; vpns 0, 4, 8 share set 0
+    assert(tlb_init(&t, 8, 2, TLB_POLICY_LRU) == 0);
+    tlb_insert(&t, 0, 0, 100);
+    tlb_insert(&t, 0, 4, 104);
+    tlb_insert(&t, 0, 1, 101);          // Other set, moves the clock on
+    assert(tlb_lookup(&t, 0, 0, &ppn) && ppn == 100);
+
+    // 4 is the least recently used way of set 0
+    tlb_insert(&t, 0, 8, 108);
+    assert(!tlb_lookup(&t, 0, 4, &ppn));
+    assert(tlb_lookup(&t, 0, 0, &ppn) && ppn == 100);
+    assert(tlb_lookup(&t, 0, 8, &ppn) && ppn == 108);
+    assert(tlb_lookup(&t, 0, 1, &ppn) && ppn == 101);
+
+    // Refilling a cached vpn updates it in place
+    tlb_insert(&t, 0, 8, 208);
+    assert(tlb_lookup(&t, 0, 8, &ppn) && ppn == 208);
+    assert(tlb_lookup(&t, 0, 0, &ppn) && ppn == 100);
+    tlb_destroy(&t);
+    printf("LRU evicted the least recently used way\n");
+}
+
+void test_tlb_clock() {
+    printf("\n=== Testing CLOCK Replacement ===\n");
+    struct tlb t;
+    unsigned long ppn;
+
+    assert(tlb_init(&t, 8, 2, TLB_POLICY_CLOCK) == 0);
+    tlb_insert(&t, 0, 0, 100);
+    tlb_insert(&t, 0, 4, 104);
+
+    // Both referenced: the hand clears them and takes the first way
+    tlb_insert(&t, 0, 8, 108);
+    assert(!tlb_lookup(&t, 0, 0, &ppn));
+    assert(tlb_lookup(&t, 0, 8, &ppn) && ppn == 108);
+
+    // 4 lost its reference bit on that pass; 8 was just filled
+    tlb_insert(&t, 0, 12, 112);
+    assert(!tlb_lookup(&t, 0, 4, &ppn));
+    assert(tlb_lookup(&t, 0, 8, &ppn) && ppn == 108);
+    assert(tlb_lookup(&t, 0, 12, &ppn) && ppn == 112);
+    tlb_destroy(&t);
+    printf("CLOCK gave referenced ways a second chance\n");
+}
+
+void test_tlb_configure() {
+    printf("\n=== Testing TLB_configure ===\n");
+    assert(TLB_configure(48, 4, TLB_POLICY_LRU) == -1);
+    assert(TLB_configure(64, 8, TLB_POLICY_CLOCK) == 0);
+
+    set_physical_mem();
+    assert(tlb_store.entries == 64 && tlb_store.ways == 8);
+    assert(tlb_store.policy == TLB_POLICY_CLOCK);
+
+    // Translations through the reconfigured TLB match the page tables
+    int pages = 32;
+    char *p = n_malloc(pages * PGSIZE);
+    assert(p != NULL);
+    for (int i = 0; i < pages; i++) {
+        int v = i * 3;
+        assert(put_data(p + i * PGSIZE, &v, sizeof(v)) == 0);
+    }
+    for (int i = 0; i < pages; i++) {
+        int v = -1;
+        get_data(p + i * PGSIZE, &v, sizeof(v));
+        assert(v == i * 3);
+        pte_t *pa = TLB_check(p + i * PGSIZE + 100);
+        assert(pa != NULL && (char *)pa - 100 == (char *)translate(page_directory, p + i * PGSIZE));
+    }
+
+    // Live reconfiguration drops the cached entries but not the mappings
+    assert(TLB_configure(TLB_ENTRIES, TLB_WAYS, TLB_POLICY_LRU) == 0);
+    assert(tlb_store.entries == TLB_ENTRIES && tlb_store.policy == TLB_POLICY_LRU);
+    for (int i = 0; i < pages; i++) {
+        int v = -1;
+        get_data(p + i * PGSIZE, &v, sizeof(v));
+        assert(v == i * 3);
+    }
+    n_free(p, pages * PGSIZE);
+    printf("Reconfigured TLB kept translating correctly\n");
+}
+
+// Every thread caches vpn -> TLB_PPN(vpn), so any hit that returns
+// something else is a torn read of an entry being rewritten
+#define TLB_PPN(vpn) ((vpn) * 7 + 3)
+#define STRESS_THREADS 4
+#define STRESS_ROUNDS 200000
+
+struct tlb shared_tlb;
+int stress_bad = 0;
+
+void *tlb_stress(void *arg) {
+    long id = (long)arg;
+    unsigned int x = (unsigned int)id * 2654435761u + 1;
+    for (int i = 0; i < STRESS_ROUNDS; i++) {
+        xorshift32(&x);
+        unsigned long vpn = x % 256;
+        unsigned long ppn;
+        switch ((x >> 8) % 8) {
+        case 0: case 1:
+            tlb_insert(&shared_tlb, 0, vpn, TLB_PPN(vpn));
+            break;
+        case 2:
+            tlb_invalidate(&shared_tlb, 0, vpn);
+            break;
+        case 3:
+            if (i % 64 == 0) tlb_flush(&shared_tlb);
+            break;
+        default:
+            if (tlb_lookup(&shared_tlb, 0, vpn, &ppn) && ppn != TLB_PPN(vpn)) {
+                __atomic_add_fetch(&stress_bad, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return NULL;
+}
+
+int shared_pages = 64;
+char *shared_mem;
+
+void *vm_reader(void *arg) {
+    long id = (long)arg;
+    for (int round = 0; round < 200; round++) {
+        // Own allocations churn the TLB while the shared pages are read
+        char *mine = n_malloc(8 * PGSIZE);
+        assert(mine != NULL);
+        int tag = (int)id * 1000 + round;
+        put_data(mine + 5 * PGSIZE, &tag, sizeof(tag));
+
+        for (int i = 0; i < shared_pages; i++) {
+            int v = -1;
+            get_data(shared_mem + i * PGSIZE, &v, sizeof(v));
+            if (v != i) __atomic_add_fetch(&stress_bad, 1, __ATOMIC_RELAXED);
+        }
+
+        int back = -1;
+        get_data(mine + 5 * PGSIZE, &back, sizeof(back));
+        if (back != tag) __atomic_add_fetch(&stress_bad, 1, __ATOMIC_RELAXED);
+        n_free(mine, 8 * PGSIZE);
+    }
+    return NULL;
+}
+
+void test_tlb_concurrent() {
+    printf("\n=== Testing Lock-free TLB Lookups ===\n");
+    pthread_t t[STRESS_THREADS];
+
+    // Small and 2-way, so lookups keep meeting entries being replaced
+    assert(tlb_init(&shared_tlb, 32, 2, TLB_POLICY_LRU) == 0);
+    for (long i = 0; i < STRESS_THREADS; i++) pthread_create(&t[i], NULL, tlb_stress, (void *)i);
+    for (int i = 0; i < STRESS_THREADS; i++) pthread_join(t[i], NULL);
+    assert(stress_bad == 0);
+    tlb_destroy(&shared_tlb);
+
+    // The same through the engine: shared pages read from every thread
+    shared_mem = n_malloc(shared_pages * PGSIZE);
+    assert(shared_mem != NULL);
+    for (int i = 0; i < shared_pages; i++) put_data(shared_mem + i * PGSIZE, &i, sizeof(i));
+    for (long i = 0; i < STRESS_THREADS; i++) pthread_create(&t[i], NULL, vm_reader, (void *)i);
+    for (int i = 0; i < STRESS_THREADS; i++) pthread_join(t[i], NULL);
+    assert(stress_bad == 0);
+    n_free(shared_mem, shared_pages * PGSIZE);
+    printf("No torn or stale translations seen\n");
+}
+
+void test_tlb_l1() {
+    printf("\n=== Testing Per-thread L1 TLB ===\n");
+    struct tlb_l1 l1;
+    unsigned long ppn;
+    memset(&l1, 0, sizeof(l1));
+
+    tlb_l1_insert(&l1, 0, 5, 50);
+    assert(tlb_l1_lookup(&l1, 0, 5, &ppn) && ppn == 50);
+    assert(!tlb_l1_lookup(&l1, 1, 5, &ppn));        // Other address space
+
+    // Direct-mapped: a vpn TLB_L1_ENTRIES further on takes the slot
+    tlb_l1_insert(&l1, 0, 5 + TLB_L1_ENTRIES, 60);
+    assert(!tlb_l1_lookup(&l1, 0, 5, &ppn));
+    assert(tlb_l1_lookup(&l1, 0, 5 + TLB_L1_ENTRIES, &ppn) && ppn == 60);
+
+    // Same epoch keeps it, a new one drops everything
+    tlb_l1_sync(&l1, 0);
+    assert(tlb_l1_lookup(&l1, 0, 5 + TLB_L1_ENTRIES, &ppn));
+    tlb_l1_sync(&l1, 1);
+    assert(!tlb_l1_lookup(&l1, 0, 5 + TLB_L1_ENTRIES, &ppn));
+    printf("L1 lookups, conflicts and epoch flushes behave\n");
+}
+
+// A thread caches a page in its L1; after another thread frees the page,
+// its next lookup must miss
+pthread_barrier_t l1_barrier;
+char *l1_page;
+
+void *l1_holder(void *arg) {
+    int v = 0;
+    get_data(l1_page, &v, sizeof(v));
+    assert(v == 77);
+    assert(TLB_check(l1_page) != NULL);
+
+    pthread_barrier_wait(&l1_barrier);      // Page cached here
+    pthread_barrier_wait(&l1_barrier);      // Freed by main
+    assert(TLB_check(l1_page) == NULL);
+    assert(translate(page_directory, l1_page) == NULL);
+    return arg;
+}
+
+void test_tlb_shootdown() {
+    printf("\n=== Testing L1 Shootdown on n_free ===\n");
+    pthread_t t;
+    l1_page = n_malloc(4 * PGSIZE);
+    assert(l1_page != NULL);
+    int v = 77;
+    put_data(l1_page, &v, sizeof(v));
+
+    pthread_barrier_init(&l1_barrier, NULL, 2);
+    pthread_create(&t, NULL, l1_holder, NULL);
+    pthread_barrier_wait(&l1_barrier);
+    n_free(l1_page, 4 * PGSIZE);
+    pthread_barrier_wait(&l1_barrier);
+    pthread_join(t, NULL);
+    pthread_barrier_destroy(&l1_barrier);
+    printf("Freed page dropped from the other thread's L1\n");
+}
+
+void test_tlb_invalidate() {
+    printf("\n=== Testing Range and Generation Invalidation ===\n");
+    struct tlb t;
+    unsigned long ppn;
+
+    assert(tlb_init(&t, 64, 4, TLB_POLICY_LRU) == 0);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) tlb_insert(&t, 0, vpn, vpn + 1000);
+
+    // A small range drops just its own pages
+    tlb_invalidate_range(&t, 0, 4, 3);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) {
+        int hit = tlb_lookup(&t, 0, vpn, &ppn);
+        assert(hit == (vpn < 4 || vpn > 6));
+        if (hit) assert(ppn == vpn + 1000);
+    }
+    tlb_invalidate(&t, 0, 9);
+    assert(!tlb_lookup(&t, 0, 9, &ppn));
+    assert(tlb_lookup(&t, 0, 10, &ppn));
+
+    // A range spanning every set drops the lot
+    tlb_invalidate_range(&t, 0, 1000, t.sets);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) assert(!tlb_lookup(&t, 0, vpn, &ppn));
+
+    // A flush is a generation bump: old entries stop matching
+    for (unsigned long vpn = 0; vpn < 16; vpn++) tlb_insert(&t, 0, vpn, vpn);
+    unsigned int gen = t.gen;
+    tlb_flush(&t);
+    assert(t.gen == gen + 1);
+    for (unsigned long vpn = 0; vpn < 16; vpn++) assert(!tlb_lookup(&t, 0, vpn, &ppn));
+    tlb_insert(&t, 0, 3, 33);
+    assert(tlb_lookup(&t, 0, 3, &ppn) && ppn == 33);
+
+    // Wrapping the generation must not revive entries from the last cycle:
+    // fill at generation 0, then come round to 0 again
+    t.gen = 0;
+    tlb_insert(&t, 0, 7, 77);
+    t.gen = 0xFFFFFFFFu;
+    tlb_flush(&t);
+    assert(t.gen == 0);
+    assert(!tlb_lookup(&t, 0, 7, &ppn));
+
+    // A range spanning every set bumps just its space's generation: the
+    // other spaces' translations stay cached
+    for (unsigned long vpn = 0; vpn < 8; vpn++) {
+        tlb_insert(&t, 0, vpn, vpn + 100);
+        tlb_insert(&t, 5, vpn, vpn + 500);
+    }
+    gen = t.gen;
+    unsigned int agen0 = t.agen[0], agen5 = t.agen[5];
+    tlb_invalidate_range(&t, 5, 0, t.sets);
+    assert(t.gen == gen && t.agen[5] == agen5 + 1 && t.agen[0] == agen0);
+    for (unsigned long vpn = 0; vpn < 8; vpn++) {
+        assert(!tlb_lookup(&t, 5, vpn, &ppn));
+        assert(tlb_lookup(&t, 0, vpn, &ppn) && ppn == vpn + 100);
+    }
+    tlb_insert(&t, 5, 2, 222);
+    assert(tlb_lookup(&t, 5, 2, &ppn) && ppn == 222);
+
+    // The same wrap-around guard per space
+    t.agen[5] = 0;
+    tlb_insert(&t, 5, 9, 99);
+    t.agen[5] = 0xFFFFFFFFu;
+    tlb_flush_asid(&t, 5);
+    assert(t.agen[5] == 0);
+    assert(!tlb_lookup(&t, 5, 9, &ppn));
+    assert(tlb_lookup(&t, 0, 3, &ppn) && ppn == 103);
+    tlb_destroy(&t);
+
+    // Through the engine: a freed range is gone, its neighbour stays cached
+    char *a = n_malloc(64 * PGSIZE);
+    char *b = n_malloc(2 * PGSIZE);
+    assert(a != NULL && b != NULL);
+    for (int i = 0; i < 64; i++) put_data(a + i * PGSIZE, &i, sizeof(i));
+    put_data(b, &gen, sizeof(gen));
+    n_free(a, 64 * PGSIZE);
+    for (int i = 0; i < 64; i++) assert(TLB_check(a + i * PGSIZE) == NULL);
+    assert(TLB_check(b) != NULL);
+    n_free(b, 2 * PGSIZE);
+    printf("Invalidation dropped exactly the freed translations\n");
+}
+
+int main() {
+    printf("Starting TLB tests...\n");
+
+    test_tlb_geometry();
+    test_tlb_lru();
+    test_tlb_clock();
+    test_tlb_configure();
+    test_tlb_concurrent();
+    test_tlb_l1();
+    test_tlb_shootdown();
+    test_tlb_invalidate();
+
+    printf("\nAll TLB tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "bitmap.h"
+#include <stdlib.h>
+#include <immintrin.h>
+
+typedef unsigned long long word_t;
+#define WORD_BITS 64
+
+// Mask of n bits starting at bit b of a word (n may be a full word)
+#define RANGE_MASK(b, n) ((n) == WORD_BITS ? ~0ULL : (((1ULL << (n)) - 1) << (b)))
+
+unsigned char *bitmap_alloc(unsigned long nbits) {
+    unsigned long words = (nbits + WORD_BITS - 1) / WORD_BITS;
+    return (unsigned char *)calloc(words ? words : 1, sizeof(word_t));
+}
+
+// Skip whole words in [i, last] with no candidate bit, i.e. words equal
+// to flip. Returns the first word that may hold one.
+static unsigned long skip_words_generic(const word_t *w, unsigned long i, unsigned long last, word_t flip) {
+    while (i <= last && w[i] == flip) i++;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static unsigned long skip_words_avx2(const word_t *w, unsigned long i, unsigned long last, word_t flip) {
+    __m256i f = _mm256_set1_epi64x((long long)flip);
+    while (i + 4 <= last + 1) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(w + i)), f);
+        if (!_mm256_testz_si256(v, v)) break;
+        i += 4;
+    }
+    return skip_words_generic(w, i, last, flip);
+}
+
+static unsigned long skip_words_resolve(const word_t *w, unsigned long i, unsigned long last, word_t flip);
+
+typedef unsigned long (*skip_fn)(const word_t *, unsigned long, unsigned long, word_t);
+
+static skip_fn skip_words = skip_words_resolve;
+
+// Pick the scanner on first use. Threads can race here; they all store
+// the same pointer, and atomically, so the race is benign.
+static unsigned long skip_words_resolve(const word_t *w, unsigned long i, unsigned long last, word_t flip) {
+    __builtin_cpu_init();
+    skip_fn pick = __builtin_cpu_supports("avx2") ? skip_words_avx2 : skip_words_generic;
+    __atomic_store_n(&skip_words, pick, __ATOMIC_RELAXED);
+    return pick(w, i, last, flip);
+}
+
+// First bit in [start, nbits) that differs from the bits of flip
+static long scan(const unsigned char *map, unsigned long start, unsigned long nbits, word_t flip) {
+    if (start >= nbits) return -1;
+
+    const word_t *w = (const word_t *)map;
+    unsigned long i = start / WORD_BITS;
+    unsigned long last = (nbits - 1) / WORD_BITS;
+    word_t cur = (w[i] ^ flip) & (~0ULL << (start % WORD_BITS));
+
+    while (!cur) {
+        i = __atomic_load_n(&skip_words, __ATOMIC_RELAXED)(w, i + 1, last, flip);
+        if (i > last) return -1;
+        cur = w[i] ^ flip;
+    }
+
+    unsigned long bit = i * WORD_BITS + __builtin_ctzll(cur);
+    return bit < nbits ? (long)bit : -1;
+}
+
+long bitmap_find_first_zero(const unsigned char *map, unsigned long start, unsigned long nbits) {
+    return scan(map, start, nbits, ~0ULL);
+}
+
+long bitmap_find_first_set(const unsigned char *map, unsigned long start, unsigned long nbits) {
+    return scan(map, start, nbits, 0);
+}
+
+// First run of `run` clear bits in [start, nbits)
+long bitmap_find_zero_run(const unsigned char *map, unsigned long start, unsigned long nbits,
+                          unsigned long run) {
+    if (run == 0) return -1;
+
+    for (;;) {
+        long zero = bitmap_find_first_zero(map, start, nbits);
+        if (zero < 0 || zero + run > nbits) return -1;
+
+        // Any set bit inside the candidate window restarts the search past it
+        long one = bitmap_find_first_set(map, zero, zero + run);
+        if (one < 0) return zero;
+        start = one + 1;
+    }
+}
+
+void bitmap_set_range(unsigned char *map, unsigned long start, unsigned long count) {
+    word_t *w = (word_t *)map;
+    unsigned long end = start + count;
+
+    while (start < end) {
+        unsigned long b = start % WORD_BITS;
+        unsigned long n = WORD_BITS - b;
+        if (n > end - start) n = end - start;
+        w[start / WORD_BITS] |= RANGE_MASK(b, n);
+        start += n;
+    }
+}
+
+void bitmap_clear_range(unsigned char *map, unsigned long start, unsigned long count) {
+    word_t *w = (word_t *)map;
+    unsigned long end = start + count;
+
+    while (start < end) {
+        unsigned long b = start % WORD_BITS;
+        unsigned long n = WORD_BITS - b;
+        if (n > end - start) n = end - start;
+        w[start / WORD_BITS] &= ~RANGE_MASK(b, n);
+        start += n;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef BITMAP_H_INCLUDED
+#define BITMAP_H_INCLUDED
+
+// Bitmap search and update primitives for the VM bitmaps.
+// Bit i lives in byte i/8 at position i%8, the layout the SET_BIT /
+// GET_BIT macros use, so both can be mixed on the same map. Scans work a
+// 64-bit word at a time, and 256 bits at a time on CPUs with AVX2.
+// Maps must come from bitmap_alloc(), which pads them to whole words.
+
+unsigned char *bitmap_alloc(unsigned long nbits);
+long bitmap_find_first_zero(const unsigned char *map, unsigned long start, unsigned long nbits);
+long bitmap_find_first_set(const unsigned char *map, unsigned long start, unsigned long nbits);
+long bitmap_find_zero_run(const unsigned char *map, unsigned long start, unsigned long nbits,
+                          unsigned long run);
+void bitmap_set_range(unsigned char *map, unsigned long start, unsigned long count);
+void bitmap_clear_range(unsigned char *map, unsigned long start, unsigned long count);
+
+#endif
@@ -0,0 +1,112 @@
+#include "buddy.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void list_push(struct buddy *b, unsigned int frame, unsigned int order) {
+    b->order[frame] = order;
+    b->prev[frame] = BUDDY_NIL;
+    b->next[frame] = b->head[order];
+    if (b->head[order] != BUDDY_NIL) b->prev[b->head[order]] = frame;
+    b->head[order] = frame;
+}
+
+static void list_remove(struct buddy *b, unsigned int frame, unsigned int order) {
+    if (b->prev[frame] != BUDDY_NIL) b->next[b->prev[frame]] = b->next[frame];
+    else b->head[order] = b->next[frame];
+    if (b->next[frame] != BUDDY_NIL) b->prev[b->next[frame]] = b->prev[frame];
+    b->order[frame] = BUDDY_USED;
+}
+
+// Largest order that is aligned at frame and fits in count frames
+static unsigned int fit_order(unsigned int frame, unsigned int count) {
+    unsigned int order = 0;
+    while (order < BUDDY_MAX_ORDER &&
+           (frame & ((2u << order) - 1)) == 0 &&
+           (2u << order) <= count) {
+        order++;
+    }
+    return order;
+}
+
+// Start with every frame allocated; callers release what is usable
+int buddy_init(struct buddy *b, unsigned int nframes) {
+    b->next = (unsigned int *)malloc(nframes * sizeof(unsigned int));
+    b->prev = (unsigned int *)malloc(nframes * sizeof(unsigned int));
+    b->order = (unsigned char *)malloc(nframes);
+
+    if (!b->next || !b->prev || !b->order) {
+        buddy_destroy(b);
+        return -1;
+    }
+
+    memset(b->order, BUDDY_USED, nframes);
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) b->head[i] = BUDDY_NIL;
+    b->nframes = nframes;
+    b->free_frames = 0;
+    return 0;
+}
+
+void buddy_destroy(struct buddy *b) {
+    free(b->next);
+    free(b->prev);
+    free(b->order);
+    b->next = NULL;
+    b->prev = NULL;
+    b->order = NULL;
+}
+
+long buddy_alloc(struct buddy *b, unsigned int order) {
+    unsigned int o = order;
+    while (o <= BUDDY_MAX_ORDER && b->head[o] == BUDDY_NIL) o++;
+    if (o > BUDDY_MAX_ORDER) return -1;
+
+    unsigned int frame = b->head[o];
+    list_remove(b, frame, o);
+
+    // Split down, handing the upper halves back
+    while (o > order) {
+        o--;
+        list_push(b, frame + (1u << o), o);
+    }
+
+    b->free_frames -= 1u << order;
+    return frame;
+}
+
+void buddy_free(struct buddy *b, unsigned int frame, unsigned int order) {
+    b->free_frames += 1u << order;
+
+    while (order < BUDDY_MAX_ORDER) {
+        unsigned int buddy = frame ^ (1u << order);
+        if (buddy >= b->nframes || b->order[buddy] != order) break;
+        list_remove(b, buddy, order);
+        frame &= ~(1u << order);
+        order++;
+    }
+    list_push(b, frame, order);
+}
+
+// Contiguous run of npages frames: take the covering power of two and
+// return the unused tail. Every frame of the run can later be freed on
+// its own with buddy_free(frame, 0).
+long buddy_alloc_pages(struct buddy *b, unsigned int npages) {
+    unsigned int order = 0;
+    while ((1u << order) < npages) order++;
+    if (order > BUDDY_MAX_ORDER) return -1;
+
+    long frame = buddy_alloc(b, order);
+    if (frame < 0) return -1;
+
+    unsigned int extra = (1u << order) - npages;
+    if (extra) buddy_free_pages(b, frame + npages, extra);
+    return frame;
+}
+
+void buddy_free_pages(struct buddy *b, unsigned int frame, unsigned int npages) {
+    while (npages) {
+        unsigned int order = fit_order(frame, npages);
+        buddy_free(b, frame, order);
+        frame += 1u << order;
+        npages -= 1u << order;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef BUDDY_H_INCLUDED
+#define BUDDY_H_INCLUDED
+
+// Binary buddy allocator over physical frame numbers.
+// Blocks of 2^order frames are kept on one free list per order and merged
+// with their buddy on free. Callers provide the locking.
+
+#define BUDDY_MAX_ORDER 20
+#define BUDDY_NIL 0xFFFFFFFFu
+
+struct buddy {
+    unsigned int nframes;
+    unsigned int free_frames;
+    unsigned int head[BUDDY_MAX_ORDER + 1];
+    unsigned int *next;         // Free list links, indexed by block head frame
+    unsigned int *prev;
+    unsigned char *order;       // Order of the free block headed here, or BUDDY_USED
+};
+
+#define BUDDY_USED 0xFF
+
+int buddy_init(struct buddy *b, unsigned int nframes);
+void buddy_destroy(struct buddy *b);
+long buddy_alloc(struct buddy *b, unsigned int order);
+void buddy_free(struct buddy *b, unsigned int frame, unsigned int order);
+long buddy_alloc_pages(struct buddy *b, unsigned int npages);
+void buddy_free_pages(struct buddy *b, unsigned int frame, unsigned int npages);
+
+#endif
@@ -0,0 +1,292 @@
+#include "extent.h"
+#include <stdlib.h>
+#include <stddef.h>
+
+#define ADDR_ENTRY(n) ((struct extent *)((char *)(n) - offsetof(struct extent, by_addr)))
+#define SIZE_ENTRY(n) ((struct extent *)((char *)(n) - offsetof(struct extent, by_size)))
+
+typedef int (*avl_cmp)(const struct avl_node *, const struct avl_node *);
+
+static int cmp_addr(const struct avl_node *a, const struct avl_node *b) {
+    unsigned long x = ADDR_ENTRY(a)->start, y = ADDR_ENTRY(b)->start;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_size(const struct avl_node *a, const struct avl_node *b) {
+    const struct extent *x = SIZE_ENTRY(a), *y = SIZE_ENTRY(b);
+    if (x->npages != y->npages) return x->npages < y->npages ? -1 : 1;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int height(struct avl_node *n) {
+    return n ? n->height : 0;
+}
+
+static void update(struct avl_node *n) {
+    int l = height(n->left), r = height(n->right);
+    n->height = 1 + (l > r ? l : r);
+}
+
+static struct avl_node *rotate_right(struct avl_node *n) {
+    struct avl_node *l = n->left;
+    n->left = l->right;
+    l->right = n;
+    update(n);
+    update(l);
+    return l;
+}
+
+static struct avl_node *rotate_left(struct avl_node *n) {
+    struct avl_node *r = n->right;
+    n->right = r->left;
+    r->left = n;
+    update(n);
+    update(r);
+    return r;
+}
+
+static struct avl_node *balance(struct avl_node *n) {
+    update(n);
+    int bf = height(n->left) - height(n->right);
+
+    if (bf > 1) {
+        if (height(n->left->left) < height(n->left->right)) n->left = rotate_left(n->left);
+        return rotate_right(n);
+    }
+    if (bf < -1) {
+        if (height(n->right->right) < height(n->right->left)) n->right = rotate_right(n->right);
+        return rotate_left(n);
+    }
+    return n;
+}
+
+static struct avl_node *avl_insert(struct avl_node *root, struct avl_node *node, avl_cmp cmp) {
+    if (!root) {
+        node->left = node->right = NULL;
+        node->height = 1;
+        return node;
+    }
+    if (cmp(node, root) < 0) root->left = avl_insert(root->left, node, cmp);
+    else root->right = avl_insert(root->right, node, cmp);
+    return balance(root);
+}
+
+static struct avl_node *avl_remove_min(struct avl_node *n, struct avl_node **min) {
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = avl_remove_min(n->left, min);
+    return balance(n);
+}
+
+static struct avl_node *avl_remove(struct avl_node *root, struct avl_node *node, avl_cmp cmp) {
+    if (!root) return NULL;
+
+    int c = cmp(node, root);
+    if (c < 0) {
+        root->left = avl_remove(root->left, node, cmp);
+    } else if (c > 0) {
+        root->right = avl_remove(root->right, node, cmp);
+    } else {
+        struct avl_node *l = root->left, *r = root->right, *min;
+        if (!r) return l;
+        r = avl_remove_min(r, &min);
+        min->left = l;
+        min->right = r;
+        return balance(min);
+    }
+    return balance(root);
+}
+
+// Last extent starting at or before vpn
+static struct extent *floor_extent(struct extent_map *m, unsigned long vpn) {
+    struct extent *best = NULL;
+    for (struct avl_node *n = m->by_addr; n; ) {
+        struct extent *e = ADDR_ENTRY(n);
+        if (e->start <= vpn) {
+            best = e;
+            n = n->right;
+        } else {
+            n = n->left;
+        }
+    }
+    return best;
+}
+
+// First extent starting after vpn
+static struct extent *next_extent(struct extent_map *m, unsigned long vpn) {
+    struct extent *best = NULL;
+    for (struct avl_node *n = m->by_addr; n; ) {
+        struct extent *e = ADDR_ENTRY(n);
+        if (e->start > vpn) {
+            best = e;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+int extent_init(struct extent_map *m, unsigned long start, unsigned long npages) {
+    m->by_addr = NULL;
+    m->by_size = NULL;
+    m->free_pages = 0;
+    m->extents = 0;
+    return npages ? extent_free(m, start, npages) : 0;
+}
+
+static void destroy_tree(struct avl_node *n) {
+    if (!n) return;
+    destroy_tree(n->left);
+    destroy_tree(n->right);
+    free(ADDR_ENTRY(n));
+}
+
+void extent_destroy(struct extent_map *m) {
+    destroy_tree(m->by_addr);
+    m->by_addr = NULL;
+    m->by_size = NULL;
+    m->free_pages = 0;
+    m->extents = 0;
+}
+
+// Best fit: the shortest extent that is long enough, lowest address on ties.
+// Returns the first page of the allocation, or 0 when nothing fits.
+unsigned long extent_alloc(struct extent_map *m, unsigned long npages) {
+    struct extent *best = NULL;
+    for (struct avl_node *n = m->by_size; n; ) {
+        struct extent *e = SIZE_ENTRY(n);
+        if (e->npages >= npages) {
+            best = e;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    if (!best || npages == 0) return 0;
+
+    unsigned long start = best->start;
+    m->by_size = avl_remove(m->by_size, &best->by_size, cmp_size);
+
+    if (best->npages == npages) {
+        m->by_addr = avl_remove(m->by_addr, &best->by_addr, cmp_addr);
+        free(best);
+        m->extents--;
+    } else {
+        // Shrinking from the front keeps its place in the address tree
+        best->start += npages;
+        best->npages -= npages;
+        m->by_size = avl_insert(m->by_size, &best->by_size, cmp_size);
+    }
+
+    m->free_pages -= npages;
+    return start;
+}
+
+// First extent at or after (npages, start) in best-fit order
+static struct extent *size_ceil(struct avl_node *n, unsigned long npages, unsigned long start) {
+    struct extent *best = NULL;
+    while (n) {
+        struct extent *e = SIZE_ENTRY(n);
+        if (e->npages > npages || (e->npages == npages && e->start >= start)) {
+            best = e;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+// Extents shorter than npages + align - 1 tried for an aligned fit while
+// a longer one is available
+#define ALIGNED_PROBES 32
+
+// An extent that holds npages starting at a multiple of align. Any extent
+// of npages + align - 1 pages does; shorter ones may, depending on where
+// they start. A few of those are tried in best-fit order before settling
+// for the smallest sure fit, so each call is O(log n). Only when there is
+// no sure fit are all the shorter ones tried.
+static struct extent *find_aligned(struct extent_map *m, unsigned long npages, unsigned long align) {
+    unsigned long sure = npages + align - 1;
+    struct extent *fit = size_ceil(m->by_size, sure, 0);
+    struct extent *e = size_ceil(m->by_size, npages, 0);
+
+    for (int i = 0; e && e->npages < sure && (i < ALIGNED_PROBES || !fit); i++) {
+        unsigned long start = (e->start + align - 1) & ~(align - 1);
+        if (start + npages <= e->start + e->npages) return e;
+        e = size_ceil(m->by_size, e->npages, e->start + 1);
+    }
+    return fit;
+}
+
+// Like extent_alloc, but the first page is a multiple of align (a power
+// of two). The pages skipped for alignment stay free.
+unsigned long extent_alloc_aligned(struct extent_map *m, unsigned long npages, unsigned long align) {
+    if (align <= 1) return extent_alloc(m, npages);
+
+    struct extent *e = npages ? find_aligned(m, npages, align) : NULL;
+    if (!e) return 0;
+
+    unsigned long head = e->start;
+    unsigned long end = e->start + e->npages;
+    unsigned long start = (head + align - 1) & ~(align - 1);
+
+    m->by_size = avl_remove(m->by_size, &e->by_size, cmp_size);
+    m->by_addr = avl_remove(m->by_addr, &e->by_addr, cmp_addr);
+    free(e);
+    m->extents--;
+    m->free_pages -= end - head;
+
+    // Hand back what's left on either side
+    extent_free(m, head, start - head);
+    extent_free(m, start + npages, end - start - npages);
+    return start;
+}
+
+// Return [start, start + npages) and merge it with adjacent free extents.
+// Ranges that overlap free space (double frees) are rejected.
+int extent_free(struct extent_map *m, unsigned long start, unsigned long npages) {
+    if (npages == 0) return 0;
+
+    struct extent *prev = floor_extent(m, start);
+    struct extent *next = next_extent(m, start);
+    if (prev && prev->start + prev->npages > start) return -1;
+    if (next && start + npages > next->start) return -1;
+
+    int merge_prev = prev && prev->start + prev->npages == start;
+    int merge_next = next && start + npages == next->start;
+
+    if (merge_prev && merge_next) {
+        m->by_size = avl_remove(m->by_size, &prev->by_size, cmp_size);
+        m->by_size = avl_remove(m->by_size, &next->by_size, cmp_size);
+        m->by_addr = avl_remove(m->by_addr, &next->by_addr, cmp_addr);
+        prev->npages += npages + next->npages;
+        m->by_size = avl_insert(m->by_size, &prev->by_size, cmp_size);
+        free(next);
+        m->extents--;
+    } else if (merge_prev) {
+        m->by_size = avl_remove(m->by_size, &prev->by_size, cmp_size);
+        prev->npages += npages;
+        m->by_size = avl_insert(m->by_size, &prev->by_size, cmp_size);
+    } else if (merge_next) {
+        // Growing backwards stays between the same neighbours
+        m->by_size = avl_remove(m->by_size, &next->by_size, cmp_size);
+        next->start = start;
+        next->npages += npages;
+        m->by_size = avl_insert(m->by_size, &next->by_size, cmp_size);
+    } else {
+        struct extent *e = (struct extent *)malloc(sizeof(struct extent));
+        if (!e) return -1;
+        e->start = start;
+        e->npages = npages;
+        m->by_addr = avl_insert(m->by_addr, &e->by_addr, cmp_addr);
+        m->by_size = avl_insert(m->by_size, &e->by_size, cmp_size);
+        m->extents++;
+    }
+
+    m->free_pages += npages;
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef EXTENT_H_INCLUDED
+#define EXTENT_H_INCLUDED
+
+// Free-extent index over virtual page numbers.
+// Every free run of pages is one extent, kept in two AVL trees: one keyed
+// by start page (to find neighbours to coalesce with) and one keyed by
+// (length, start) for best-fit lookups. Callers provide the locking.
+
+struct avl_node {
+    struct avl_node *left;
+    struct avl_node *right;
+    int height;
+};
+
+struct extent {
+    unsigned long start;
+    unsigned long npages;
+    struct avl_node by_addr;
+    struct avl_node by_size;
+};
+
+struct extent_map {
+    struct avl_node *by_addr;
+    struct avl_node *by_size;
+    unsigned long free_pages;
+    unsigned long extents;
+};
+
+int extent_init(struct extent_map *m, unsigned long start, unsigned long npages);
+void extent_destroy(struct extent_map *m);
+unsigned long extent_alloc(struct extent_map *m, unsigned long npages);
+unsigned long extent_alloc_aligned(struct extent_map *m, unsigned long npages, unsigned long align);
+int extent_free(struct extent_map *m, unsigned long start, unsigned long npages);
+
+#endif
@@ -0,0 +1,194 @@
+#include "gemm.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+typedef void (*kernel_fn)(int, int, int, const int *, int, const int *, int, int *, int);
+
+// Plain C += A * B, row by row so the inner loop runs along B and C rows
+static void kernel_generic(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        for (int p = 0; p < k; p++) {
+            int av = a[i * lda + p];
+            const int *brow = b + p * ldb;
+            int *crow = c + i * ldc;
+            for (int j = 0; j < n; j++) crow[j] += av * brow[j];
+        }
+    }
+}
+
+// 4 x 16 blocks held in eight registers across the whole k loop
+__attribute__((target("avx2")))
+static void kernel_avx2(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    int i = 0;
+    for (; i + 4 <= m; i += 4) {
+        int j = 0;
+        for (; j + 16 <= n; j += 16) {
+            __m256i acc[4][2];
+            for (int r = 0; r < 4; r++) {
+                acc[r][0] = _mm256_loadu_si256((const __m256i *)(c + (i + r) * ldc + j));
+                acc[r][1] = _mm256_loadu_si256((const __m256i *)(c + (i + r) * ldc + j + 8));
+            }
+            for (int p = 0; p < k; p++) {
+                __m256i b0 = _mm256_loadu_si256((const __m256i *)(b + p * ldb + j));
+                __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + p * ldb + j + 8));
+                for (int r = 0; r < 4; r++) {
+                    __m256i av = _mm256_set1_epi32(a[(i + r) * lda + p]);
+                    acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_mullo_epi32(av, b0));
+                    acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_mullo_epi32(av, b1));
+                }
+            }
+            for (int r = 0; r < 4; r++) {
+                _mm256_storeu_si256((__m256i *)(c + (i + r) * ldc + j), acc[r][0]);
+                _mm256_storeu_si256((__m256i *)(c + (i + r) * ldc + j + 8), acc[r][1]);
+            }
+        }
+        if (j < n) kernel_generic(4, n - j, k, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc);
+    }
+    if (i < m) kernel_generic(m - i, n, k, a + i * lda, lda, b, ldb, c + i * ldc, ldc);
+}
+
+// The same blocking at 4 x 8 for CPUs with SSE4.1 (pmulld) only
+__attribute__((target("sse4.1")))
+static void kernel_sse41(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    int i = 0;
+    for (; i + 4 <= m; i += 4) {
+        int j = 0;
+        for (; j + 8 <= n; j += 8) {
+            __m128i acc[4][2];
+            for (int r = 0; r < 4; r++) {
+                acc[r][0] = _mm_loadu_si128((const __m128i *)(c + (i + r) * ldc + j));
+                acc[r][1] = _mm_loadu_si128((const __m128i *)(c + (i + r) * ldc + j + 4));
+            }
+            for (int p = 0; p < k; p++) {
+                __m128i b0 = _mm_loadu_si128((const __m128i *)(b + p * ldb + j));
+                __m128i b1 = _mm_loadu_si128((const __m128i *)(b + p * ldb + j + 4));
+                for (int r = 0; r < 4; r++) {
+                    __m128i av = _mm_set1_epi32(a[(i + r) * lda + p]);
+                    acc[r][0] = _mm_add_epi32(acc[r][0], _mm_mullo_epi32(av, b0));
+                    acc[r][1] = _mm_add_epi32(acc[r][1], _mm_mullo_epi32(av, b1));
+                }
+            }
+            for (int r = 0; r < 4; r++) {
+                _mm_storeu_si128((__m128i *)(c + (i + r) * ldc + j), acc[r][0]);
+                _mm_storeu_si128((__m128i *)(c + (i + r) * ldc + j + 4), acc[r][1]);
+            }
+        }
+        if (j < n) kernel_generic(4, n - j, k, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc);
+    }
+    if (i < m) kernel_generic(m - i, n, k, a + i * lda, lda, b, ldb, c + i * ldc, ldc);
+}
+
+static void kernel_resolve(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc);
+
+static kernel_fn kernel = kernel_resolve;
+
+// Pick the kernel on first use. Parallel workers can race here; they all
+// store the same pointer, and atomically, so the race is benign.
+static void kernel_resolve(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    kernel_fn pick;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) pick = kernel_avx2;
+    else if (__builtin_cpu_supports("sse4.1")) pick = kernel_sse41;
+    else pick = kernel_generic;
+    __atomic_store_n(&kernel, pick, __ATOMIC_RELAXED);
+    pick(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+void gemm_i32(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc) {
+    __atomic_load_n(&kernel, __ATOMIC_RELAXED)(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+static void *elem_va(const struct gemm_vm *g, void *mat, int row, int col) {
+    return (char *)mat + ((unsigned long)row * g->size + col) * sizeof(int);
+}
+
+// Copy a rows x cols block at (row, col) of a VM matrix into buf
+static void load_tile(const struct gemm_vm *g, void *mat, int row, int col,
+                      int rows, int cols, int *buf, int ld) {
+    for (int r = 0; r < rows; r++) {
+        g->get(elem_va(g, mat, row + r, col), buf + r * ld, cols * sizeof(int));
+    }
+}
+
+int gemm_vm_tiles(int size) {
+    if (size <= 0) return 0;
+    return ((size + GEMM_TILE_I - 1) / GEMM_TILE_I) * ((size + GEMM_TILE_J - 1) / GEMM_TILE_J);
+}
+
+// Build one GEMM_TILE_I x GEMM_TILE_J tile of C in scratch, which holds
+// GEMM_SCRATCH_INTS ints, and store it
+int gemm_vm_tile(const struct gemm_vm *g, int tile, int *scratch) {
+    int size = g->size;
+    int tiles_j = (size + GEMM_TILE_J - 1) / GEMM_TILE_J;
+    int i0 = (tile / tiles_j) * GEMM_TILE_I;
+    int j0 = (tile % tiles_j) * GEMM_TILE_J;
+    int mi = size - i0 < GEMM_TILE_I ? size - i0 : GEMM_TILE_I;
+    int nj = size - j0 < GEMM_TILE_J ? size - j0 : GEMM_TILE_J;
+
+    int *at = scratch;
+    int *bt = at + GEMM_TILE_I * GEMM_TILE_K;
+    int *ct = bt + GEMM_TILE_K * GEMM_TILE_J;
+    memset(ct, 0, GEMM_TILE_I * GEMM_TILE_J * sizeof(int));
+
+    for (int k0 = 0; k0 < size; k0 += GEMM_TILE_K) {
+        int nk = size - k0 < GEMM_TILE_K ? size - k0 : GEMM_TILE_K;
+        load_tile(g, g->a, i0, k0, mi, nk, at, GEMM_TILE_K);
+        load_tile(g, g->b, k0, j0, nk, nj, bt, GEMM_TILE_J);
+        gemm_i32(mi, nj, nk, at, GEMM_TILE_K, bt, GEMM_TILE_J, ct, GEMM_TILE_J);
+    }
+
+    for (int r = 0; r < mi; r++) {
+        if (g->put(elem_va(g, g->c, i0 + r, j0), ct + r * GEMM_TILE_J, nj * sizeof(int)) != 0) return -1;
+    }
+    return 0;
+}
+
+int gemm_vm(const struct gemm_vm *g) {
+    int *scratch = malloc(GEMM_SCRATCH_INTS * sizeof(int));
+    if (!scratch) return -1;
+
+    int ret = 0;
+    int tiles = gemm_vm_tiles(g->size);
+    for (int t = 0; t < tiles && ret == 0; t++) ret = gemm_vm_tile(g, t, scratch);
+
+    free(scratch);
+    return ret;
+}
+
+struct gemm_job {
+    const struct gemm_vm *g;
+    int *scratch;               // GEMM_SCRATCH_INTS per worker
+    int failed;
+};
+
+static struct task_pool gemm_pool = TASK_POOL_INITIALIZER;
+
+static void gemm_task(void *arg, int tile, int worker) {
+    struct gemm_job *job = (struct gemm_job *)arg;
+    const struct gemm_vm *g = job->g;
+    int *scratch = job->scratch + (long)worker * GEMM_SCRATCH_INTS;
+
+    // Workers outlive the job, so they borrow the caller's space per tile
+    void *prev = g->bind ? g->bind(g->space) : NULL;
+    if (gemm_vm_tile(g, tile, scratch) != 0) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    if (g->bind) g->bind(prev);
+}
+
+int gemm_vm_parallel(const struct gemm_vm *g, int nthreads) {
+    int tiles = gemm_vm_tiles(g->size);
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > POOL_MAX_WORKERS) nthreads = POOL_MAX_WORKERS;
+    if (nthreads > tiles) nthreads = tiles;
+    if (nthreads <= 1) return gemm_vm(g);
+
+    struct gemm_job job = { g, malloc((long)nthreads * GEMM_SCRATCH_INTS * sizeof(int)), 0 };
+    if (!job.scratch) return gemm_vm(g);
+
+    int ret = pool_run(&gemm_pool, nthreads, tiles, gemm_task, &job);
+    free(job.scratch);
+    if (ret != 0) return gemm_vm(g);
+    return job.failed ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef GEMM_H_INCLUDED
+#define GEMM_H_INCLUDED
+
+// Tiled int matrix multiply over virtual memory.
+// Each output tile of C = A * B is built in a small host buffer: tiles of
+// A and B are moved in a row segment at a time with the engine's get_data,
+// multiplied by a register-blocked kernel (AVX2 or SSE4.1 when the CPU
+// has them, picked on first use), and the finished tile goes back with
+// put_data. Tile rows are 1 KB, so for sizes that are multiples of 256
+// no row segment crosses a page and each costs one translation.
+
+#define GEMM_TILE_I 128
+#define GEMM_TILE_J 256
+#define GEMM_TILE_K 128
+#define GEMM_SCRATCH_INTS (GEMM_TILE_I * GEMM_TILE_K + GEMM_TILE_K * GEMM_TILE_J + GEMM_TILE_I * GEMM_TILE_J)
+
+// Row-major size x size matrices in virtual memory and the engine's copies
+struct gemm_vm {
+    void *a;
+    void *b;
+    void *c;
+    int size;
+    void (*get)(void *va, void *val, int size);
+    int (*put)(void *va, void *val, int size);
+    // Optional: make space the calling thread's current one and return the
+    // one it replaces, so pool workers translate in the caller's space
+    void *space;
+    void *(*bind)(void *space);
+};
+
+// C += A * B on host memory; m x k times k x n with row strides lda etc.
+void gemm_i32(int m, int n, int k, const int *a, int lda, const int *b, int ldb, int *c, int ldc);
+
+// Output tiles of a size x size product, and the one at index tile
+int gemm_vm_tiles(int size);
+int gemm_vm_tile(const struct gemm_vm *g, int tile, int *scratch);
+
+// Whole product, one tile at a time; -1 if scratch or a store failed
+int gemm_vm(const struct gemm_vm *g);
+
+// Whole product with the tiles spread over nthreads workers of a shared
+// pool (nthreads <= 0: one per online CPU). The engine's get / put must
+// be safe to call from several threads at once.
+int gemm_vm_parallel(const struct gemm_vm *g, int nthreads);
+
+#endif
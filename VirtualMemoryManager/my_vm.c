@@ -1,20 +1,139 @@
 #include "my_vm.h"
 #include <sys/mman.h>
 #include <string.h>
+#include <sched.h>
 
 void *physical_memory = NULL;
-unsigned char *physical_bitmap = NULL;
-unsigned char *virtual_bitmap = NULL;
+unsigned char *physical_bitmap = NULL;   // Debug view of frame_pool
+unsigned char *frame_touched = NULL;     // Frames handed out at least once
+struct buddy frame_pool;
+unsigned char *virtual_bitmap = NULL;    // Debug view of va_space
+struct extent_map va_space;
+struct slab_allocator slab_pool;        // Requests up to SLAB_MAX_SIZE bytes
 pde_t *page_directory = NULL;
 struct tlb tlb_store;
+struct tlb tlb_large;                   // Superpage translations, keyed by vpn >> LARGE_PAGE_ORDER
 pthread_mutex_t tlb_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t virtual_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-unsigned long long tlb_hits = 0;
-unsigned long long tlb_misses = 0;
+// TLB hit/miss counters, striped per thread so lookups don't share a line
+#define TLB_STAT_STRIPES 64
+struct tlb_stat {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long l1_hits;
+    unsigned long long large_hits;
+} __attribute__((aligned(64)));
+struct tlb_stat tlb_stats[TLB_STAT_STRIPES];
+unsigned int tlb_stat_next = 0;
+__thread int tlb_stat_slot = -1;
+
+// Per-thread L1 TLB. n_free bumps tlb_epoch after invalidating the shared
+// TLB, and every thread drops its L1 on the next lookup that sees the bump.
+unsigned int tlb_epoch = 0;
+__thread struct tlb_l1 tlb_l1;
 int memory_initialized = 0;
 
+// Per-thread magazines of free frames and free virtual ranges. They refill
+// from and drain to frame_pool / the current space's va in batches, so
+// common n_malloc / n_free calls take no global lock. The cached ranges
+// go back to their space when the thread switches to another one.
+#define FRAME_MAG_SIZE 64
+#define FRAME_MAG_ORDER 5
+#define FRAME_MAG_BATCH (1 << FRAME_MAG_ORDER)
+#define VA_MAG_SIZE 32
+#define VA_MAG_MAX_PAGES 16     // Larger ranges go straight to the space's index
+#define VA_CHUNK_PAGES 256
+
+struct vm_magazine {
+    unsigned int nframes;
+    unsigned long frames[FRAME_MAG_SIZE];
+    unsigned int nranges;
+    unsigned long range_vpn[VA_MAG_SIZE];
+    unsigned int range_len[VA_MAG_SIZE];
+    unsigned long chunk_vpn;        // Private bump region for small ranges
+    unsigned long chunk_left;
+    int registered;
+};
+__thread struct vm_magazine vm_mag;
+pthread_key_t vm_mag_key;
+pthread_once_t vm_mag_once = PTHREAD_ONCE_INIT;
+
+// TLB geometry, changeable through TLB_configure()
+unsigned int tlb_entries = TLB_ENTRIES;
+unsigned int tlb_ways = TLB_WAYS;
+int tlb_policy = TLB_POLICY_LRU;
+
+// Demand paging: n_malloc reserves pages and translate() backs them on
+// first touch. Off by default.
+int demand_paging = 0;
+unsigned long long demand_faults = 0;
+
+// Swap: once frames run out, swap_out() picks a resident page with a CLOCK
+// sweep over frame_owner (the frame -> page reverse map) and writes it to
+// swap_store. Its PTE then holds the slot number with PTE_SWAPPED set, and
+// translate() reads it back in on the next access.
+struct swap_area swap_store = { .fd = -1 };
+int swap_enabled = 0;
+unsigned long *frame_owner = NULL;      // PAGE_OWNER of each frame's page, 0 if none
+unsigned int *frame_busy = NULL;        // Copies in flight plus n_pin holds
+unsigned long clock_hand = 0;
+pthread_mutex_t swap_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long major_faults = 0;
+
+// Set in frame_busy when the page is freed while the frame is still held;
+// whoever drops the last hold returns the frame to the pool
+#define FRAME_RETIRED 0x80000000u
+
+// Copy-on-write: n_fork maps a range's frames a second time with PTE_WRITE
+// clear in both copies. frame_shares counts a frame's mappings beyond the
+// first, and a shared frame's owner is FRAME_SHARED, which keeps swap off
+// it. The first write through a read-only entry copies the page, or just
+// takes it back once no other mapping is left. TLB entries of read-only
+// pages carry TLB_READONLY in their frame number, so writes miss on them.
+#define FRAME_SHARED (~0UL)
+#define TLB_READONLY (1UL << (sizeof(unsigned long) * 8 - 1))
+unsigned int *frame_shares = NULL;
+int cow_active = 0;                     // Set by the first n_fork
+pthread_mutex_t cow_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long cow_faults = 0;
+
+// Page-granular requests of at least this many bytes are mapped with
+// superpages where whole ones fit; 0 turns them off
+unsigned int superpage_threshold = LARGE_PAGE_SIZE;
+
+// Address spaces: each has a page directory, virtual address index and
+// slab allocator of its own, and maps frames from the one shared pool.
+// The default space is page_directory / va_space / slab_pool; threads
+// start in it and vm_space_switch() moves them between spaces. TLB
+// entries carry the space's ASID, so a switch keeps them all cached.
+// frame_owner names a page by space and vpn, so swap can find its entry.
+struct vm_space {
+    pde_t *pgdir;
+    unsigned int asid;
+    struct extent_map *va;
+    unsigned char *vbitmap;             // Debug view of va, default space only
+    pthread_mutex_t *va_lock;
+    struct slab_allocator *slab;
+    int users;                          // Threads it is current on
+    struct extent_map own_va;
+    pthread_mutex_t own_lock;
+    struct slab_allocator own_slab;
+};
+
+#define PAGE_OWNER(s, vpn) ((unsigned long)(s)->asid * TOTAL_VIRTUAL_PAGES + (vpn))
+
+struct vm_space vm_default = { .va = &va_space, .va_lock = &virtual_mem_mutex, .slab = &slab_pool };
+struct vm_space *vm_spaces[VM_MAX_SPACES] = { &vm_default };   // By ASID, for swap_out()
+unsigned char vm_asids[(VM_MAX_SPACES + 7) / 8] = { 1 };       // ASIDs taken
+pthread_mutex_t space_mutex = PTHREAD_MUTEX_INITIALIZER;
+__thread struct vm_space *vm_current = &vm_default;
+
+static inline struct vm_space *space_mine() {
+    return vm_current;
+}
+
 
 // Dynamic page table constants initialization
  // Default for 4KB pages
@@ -30,25 +149,42 @@ unsigned long PAGE_TABLE_MASK = 0x3FF;
 
 void cleanup_physical_mem() {
     if (physical_memory) {
-        free(physical_memory);
+        munmap(physical_memory, MEMSIZE);
         physical_memory = NULL;
     }
     if (physical_bitmap) {
         free(physical_bitmap);
         physical_bitmap = NULL;
     }
+    if (frame_touched) {
+        free(frame_touched);
+        frame_touched = NULL;
+    }
     if (virtual_bitmap) {
         free(virtual_bitmap);
         virtual_bitmap = NULL;
     }
-    if (tlb_store.vpn) free(tlb_store.vpn);
-    if (tlb_store.ppn) free(tlb_store.ppn);
-    if (tlb_store.valid) free(tlb_store.valid);
-    tlb_store.vpn = NULL;
-    tlb_store.ppn = NULL;
-    tlb_store.valid = NULL;
+    free(frame_owner);
+    frame_owner = NULL;
+    free(frame_busy);
+    frame_busy = NULL;
+    free(frame_shares);
+    frame_shares = NULL;
+    swap_close(&swap_store);
+    swap_enabled = 0;
+    tlb_destroy(&tlb_store);
+    tlb_destroy(&tlb_large);
+    buddy_destroy(&frame_pool);
+    extent_destroy(&va_space);
+    vm_mag.nframes = 0;
+    vm_mag.nranges = 0;
+    vm_mag.chunk_left = 0;
+    slab_destroy(&slab_pool);
 }
 
+static unsigned long slab_get_page(void);
+static void slab_put_page(unsigned long vpn);
+
 void set_physical_mem() {
     pthread_mutex_lock(&init_mutex);
     
@@ -57,41 +193,61 @@ void set_physical_mem() {
         return;
     }
 
-    physical_memory = malloc(MEMSIZE);
-    if (!physical_memory) {
+    // Reserve the arena without committing it; frames are populated when
+    // first touched and zeroed at allocation, not up front
+    physical_memory = mmap(NULL, MEMSIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (physical_memory == MAP_FAILED) {
+        physical_memory = NULL;
         perror("Physical memory allocation failed");
         pthread_mutex_unlock(&init_mutex);
         exit(1);
     }
-    memset(physical_memory, 0, MEMSIZE);
 
-    size_t physical_bitmap_size = (TOTAL_PHYSICAL_PAGES + 7) / 8;
-    size_t virtual_bitmap_size = (TOTAL_VIRTUAL_PAGES + 7) / 8;
-
-    physical_bitmap = malloc(physical_bitmap_size);
-    virtual_bitmap = malloc(virtual_bitmap_size);
+    physical_bitmap = bitmap_alloc(TOTAL_PHYSICAL_PAGES);
+    virtual_bitmap = bitmap_alloc(TOTAL_VIRTUAL_PAGES);
+    frame_touched = bitmap_alloc(TOTAL_PHYSICAL_PAGES);
+    frame_owner = calloc(TOTAL_PHYSICAL_PAGES, sizeof(unsigned long));
+    frame_busy = calloc(TOTAL_PHYSICAL_PAGES, sizeof(unsigned int));
+    frame_shares = calloc(TOTAL_PHYSICAL_PAGES, sizeof(unsigned int));
     
-    if (!physical_bitmap || !virtual_bitmap) {
+    if (!physical_bitmap || !virtual_bitmap || !frame_touched || !frame_owner || !frame_busy || !frame_shares) {
         perror("Bitmap allocation failed");
         cleanup_physical_mem();
         pthread_mutex_unlock(&init_mutex);
         exit(1);
     }
 
-    memset(physical_bitmap, 0, physical_bitmap_size);
-    memset(virtual_bitmap, 0, virtual_bitmap_size);
-
     // Initialize page directory
     page_directory = (pde_t *)physical_memory;
     memset(page_directory, 0, PAGE_SIZE);
+    vm_default.pgdir = page_directory;
+    vm_default.vbitmap = virtual_bitmap;
     SET_BIT(physical_bitmap, 0);
+    SET_BIT(frame_touched, 0);
+
+    // Every frame but the page directory's goes to the buddy allocator
+    if (buddy_init(&frame_pool, TOTAL_PHYSICAL_PAGES) != 0) {
+        perror("Frame allocator initialization failed");
+        cleanup_physical_mem();
+        pthread_mutex_unlock(&init_mutex);
+        exit(1);
+    }
+    buddy_free_pages(&frame_pool, 1, TOTAL_PHYSICAL_PAGES - 1);
+
+    // Virtual page 0 stays unmapped so NULL is never handed out
+    if (extent_init(&va_space, 1, TOTAL_VIRTUAL_PAGES - 1) != 0) {
+        perror("Virtual address space initialization failed");
+        cleanup_physical_mem();
+        pthread_mutex_unlock(&init_mutex);
+        exit(1);
+    }
+
+    slab_init(&slab_pool, PAGE_SIZE, slab_get_page, slab_put_page);
 
     // Initialize TLB arrays
-    tlb_store.vpn = (unsigned long *)calloc(TLB_ENTRIES, sizeof(unsigned long));
-    tlb_store.ppn = (unsigned long *)calloc(TLB_ENTRIES, sizeof(unsigned long));
-    tlb_store.valid = (unsigned char *)calloc(TLB_ENTRIES, sizeof(unsigned char));
-    
-    if (!tlb_store.vpn || !tlb_store.ppn || !tlb_store.valid) {
+    if (tlb_init(&tlb_store, tlb_entries, tlb_ways, tlb_policy) != 0 ||
+        tlb_init(&tlb_large, TLB_LARGE_ENTRIES, TLB_LARGE_WAYS, TLB_POLICY_LRU) != 0) {
         perror("TLB allocation failed");
         cleanup_physical_mem();
         pthread_mutex_unlock(&init_mutex);
@@ -102,131 +258,715 @@ void set_physical_mem() {
     pthread_mutex_unlock(&init_mutex);
 }
 
-pte_t* translate(pde_t *pgdir, void *va) {
+static long frame_get();
+static void frame_put(unsigned long frame);
+static void put_frames(void *pa, int num_pages);
+
+// Entry for va in pgdir's page tables, allocating the page table if create
+// is set. NULL when the table is missing or cannot be allocated, or va is
+// mapped by a superpage. Mappers of disjoint ranges can share a directory
+// entry, so a new table goes in with a CAS and the loser of a race hands
+// its table back and uses the winner's.
+static pte_t *pte_slot(pde_t *pgdir, void *va, int create) {
+    pde_t *dir_entry = &pgdir[GET_PAGE_DIR_INDEX(va)];
+    pde_t pde = __atomic_load_n(dir_entry, __ATOMIC_ACQUIRE);
+    
+    while (!(pde & 0x1)) {
+        if (!create) return NULL;
+        void *new_pt = get_next_avail(1);
+        if (!new_pt) return NULL;
+        
+        memset(new_pt, 0, PAGE_SIZE);
+        pde_t table = ((unsigned long)new_pt - (unsigned long)physical_memory) | 0x7;
+        if (__atomic_compare_exchange_n(dir_entry, &pde, table, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            pde = table;
+        } else {
+            put_frames(new_pt, 1);
+        }
+    }
+    if (pde & PDE_LARGE) return NULL;
+
+    pte_t *page_table = (pte_t *)((pde & ~0xFFF) + (unsigned long)physical_memory);
+    return &page_table[GET_PAGE_TABLE_INDEX(va)];
+}
+
+// First touch of a demand-paged page: back it with a zeroed frame. Racing
+// faults on the same page agree through the CAS and the loser's frame goes
+// back to its magazine. Returns 0 once the entry is present.
+static int page_fault(pte_t *pt_entry, pte_t old, unsigned long owner) {
+    long frame = frame_get();
+    if (frame < 0) return -1;
+    
+    __atomic_store_n(&frame_owner[frame], owner, __ATOMIC_RELAXED);
+    pte_t pte = ((pte_t)frame << OFFSET_BITS) | 0x7 | PTE_ACCESSED;
+    if (__atomic_compare_exchange_n(pt_entry, &old, pte, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&demand_faults, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    
+    __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_RELAXED);
+    frame_put(frame);
+    return 0;
+}
+
+// Major fault: read a swapped-out page back into a fresh frame. The entry
+// is locked meanwhile, so other walks of it wait. Returns 0 once someone
+// has started bringing it in.
+static int swap_in(pte_t *pt_entry, pte_t old, unsigned long owner) {
+    pte_t locked = (old & ~0xFFF) | PTE_LOCKED;
+    if (!__atomic_compare_exchange_n(pt_entry, &old, locked, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    
+    unsigned long slot = old >> OFFSET_BITS;
+    long frame = frame_get();
+    if (frame < 0 || swap_read(&swap_store, slot, physical_memory + (frame * PAGE_SIZE)) != 0) {
+        if (frame >= 0) frame_put(frame);
+        __atomic_store_n(pt_entry, old, __ATOMIC_RELEASE);
+        return -1;
+    }
+    swap_free(&swap_store, slot);
+    
+    __atomic_store_n(&frame_owner[frame], owner, __ATOMIC_RELAXED);
+    __atomic_store_n(pt_entry, ((pte_t)frame << OFFSET_BITS) | 0x7 | PTE_ACCESSED, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&major_faults, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int frame_unshare(unsigned long frame);
+static void frame_drop(unsigned long frame);
+static void space_invalidate(struct vm_space *s, unsigned long vpn, unsigned long npages);
+
+// Write through a read-only entry of a shared page: copy the page to a
+// frame of our own, or take the frame back if no other mapping is left.
+// Returns 0 once the entry has been dealt with (or changed under us).
+static int cow_break(struct vm_space *s, pte_t *pt_entry, pte_t pte, unsigned long vpn) {
+    unsigned long frame = pte >> OFFSET_BITS;
+    int ret = 0;
+    
+    // Serialized with n_fork, which is what adds mappings
+    pthread_mutex_lock(&cow_mutex);
+    if (__atomic_load_n(pt_entry, __ATOMIC_ACQUIRE) != pte) goto out;
+    
+    if (__atomic_load_n(&frame_shares[frame], __ATOMIC_ACQUIRE) == 0) {
+        __atomic_store_n(&frame_owner[frame], PAGE_OWNER(s, vpn), __ATOMIC_SEQ_CST);
+        __atomic_store_n(pt_entry, pte | PTE_WRITE, __ATOMIC_RELEASE);
+        space_invalidate(s, vpn, 1);
+        goto out;
+    }
+    
+    long copy = frame_get();
+    if (copy < 0) {
+        ret = -1;
+        goto out;
+    }
+    memcpy(physical_memory + (copy * PAGE_SIZE), physical_memory + (frame * PAGE_SIZE), PAGE_SIZE);
+    __atomic_store_n(&frame_owner[copy], PAGE_OWNER(s, vpn), __ATOMIC_RELAXED);
+    __atomic_store_n(pt_entry, ((pte_t)copy << OFFSET_BITS) | 0x7 | PTE_ACCESSED, __ATOMIC_RELEASE);
+    space_invalidate(s, vpn, 1);
+    
+    // A racing free of the other mapping may have left this one the last
+    if (frame_unshare(frame)) frame_drop(frame);
+    __atomic_fetch_add(&cow_faults, 1, __ATOMIC_RELAXED);
+out:
+    pthread_mutex_unlock(&cow_mutex);
+    return ret;
+}
+
+static pte_t *tlb_check(struct vm_space *s, void *va, int write);
+static void tlb_add(struct vm_space *s, void *va, void *pa);
+
+// Table walk behind translate(), in space s. A write also breaks
+// copy-on-write sharing, so the frame it returns is the page's own.
+static pte_t *walk(struct vm_space *s, void *va, int write) {
     // Check TLB first
-    pte_t *tlb_result = TLB_check(va);
+    pte_t *tlb_result = tlb_check(s, va, write);
     if (tlb_result) return tlb_result;
 
-    unsigned long dir_idx = GET_PAGE_DIR_INDEX(va);
-    unsigned long page_idx = GET_PAGE_TABLE_INDEX(va);
+    pde_t *pgdir = s->pgdir;
     unsigned long offset = GET_OFFSET(va);
 
-    pde_t *dir_entry = &pgdir[dir_idx];
-    if (!(*dir_entry & 0x1)) return NULL;  // Present bit check
+    // A superpage maps the whole 4 MB straight from the directory
+    pde_t pde = __atomic_load_n(&pgdir[GET_PAGE_DIR_INDEX(va)], __ATOMIC_ACQUIRE);
+    if ((pde & 0x1) && (pde & PDE_LARGE)) {
+        void *pa = physical_memory + (pde & ~0xFFF) + ((unsigned long)va & (LARGE_PAGE_SIZE - 1));
+        tlb_add(s, va, pa);
+        return (pte_t *)pa;
+    }
 
-    pte_t *page_table = (pte_t *)((*dir_entry & ~0xFFF) + (unsigned long)physical_memory);
-    pte_t *pt_entry = &page_table[page_idx];
+    pte_t *pt_entry = pte_slot(pgdir, va, 0);
+    if (!pt_entry) return NULL;  // Directory entry not present
     
-    if (!(*pt_entry & 0x1)) return NULL;  // Present bit check
+    pte_t pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+    while (!(pte & 0x1) || (write && !(pte & PTE_WRITE))) {
+        if (pte & 0x1) {
+            if (cow_break(s, pt_entry, pte, GET_VPN(va)) != 0) return NULL;
+        } else if (pte & PTE_LOCKED) {
+            // Another thread is swapping this page out or in
+            sched_yield();
+        } else if (pte & PTE_SWAPPED) {
+            if (swap_in(pt_entry, pte, PAGE_OWNER(s, GET_VPN(va))) != 0) return NULL;
+        } else if (pte & PTE_RESERVED) {
+            // Reserved by a demand-paged n_malloc: fault the frame in
+            if (page_fault(pt_entry, pte, PAGE_OWNER(s, GET_VPN(va))) != 0) return NULL;
+        } else {
+            return NULL;
+        }
+        pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+    }
+    
+    // Accessed bit for the CLOCK sweep; hits in the TLB don't come here,
+    // so the sweep drops a page's translation when it clears the bit
+    if (!(pte & PTE_ACCESSED)) __atomic_fetch_or(pt_entry, PTE_ACCESSED, __ATOMIC_RELAXED);
 
-    void *pa = physical_memory + (*pt_entry & ~0xFFF) + offset;
-    TLB_add(va, pa);
+    void *pa = physical_memory + (pte & ~0xFFF) + offset;
+    tlb_add(s, va, pa);
     return (pte_t *)pa;
 }
 
+// pgdir has to be the calling thread's current one (page_directory unless
+// it switched spaces); other directories translate to NULL
+pte_t* translate(pde_t *pgdir, void *va) {
+    struct vm_space *s = space_mine();
+    if (pgdir != s->pgdir) return NULL;
+    return walk(s, va, 0);
+}
+
+// Install va -> pa with a CAS, so of two racing mappers of one page only
+// one succeeds; -1 if the page is already mapped. Like translate(), only
+// in the current space, whose ASID the frame's owner tag names.
 int map_page(pde_t *pgdir, void *va, void *pa) {
-    unsigned long dir_idx = GET_PAGE_DIR_INDEX(va);
-    unsigned long page_idx = GET_PAGE_TABLE_INDEX(va);
+    if (pgdir != space_mine()->pgdir) return -1;
+    pte_t *pt_entry = pte_slot(pgdir, va, 1);
+    if (!pt_entry) return -1;
+    
+    pte_t old = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+    if (old & 0x1) return -1;  // Already mapped
+
+    // The owner goes in first, so anyone who sees the entry sees it
+    unsigned long frame = ((unsigned long)pa - (unsigned long)physical_memory) >> OFFSET_BITS;
+    __atomic_store_n(&frame_owner[frame], PAGE_OWNER(space_mine(), GET_VPN(va)), __ATOMIC_RELAXED);
+    pte_t pte = ((unsigned long)pa - (unsigned long)physical_memory) | 0x7;
+    if (!__atomic_compare_exchange_n(pt_entry, &old, pte, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+// Frames come out of the mapping zero-filled, so only recycled ones need
+// clearing. Skipping the rest keeps fresh frames untouched until used.
+static void frame_zero(unsigned long frame) {
+    unsigned char bit = 1 << (frame % 8);
+    if (__atomic_fetch_or(&frame_touched[frame / 8], bit, __ATOMIC_RELAXED) & bit) {
+        memset(physical_memory + (frame * PAGE_SIZE), 0, PAGE_SIZE);
+    }
+}
 
-    pde_t *dir_entry = &pgdir[dir_idx];
+// Write one resident page to swap and leave its PTE pointing at the slot.
+// Returns 0 on success, 1 if the page changed or is being copied, -1 if
+// the swap area failed.
+static int page_evict(struct vm_space *s, pte_t *pt_entry, pte_t pte, unsigned long frame, unsigned long vpn) {
+    long slot = swap_alloc(&swap_store);
+    if (slot < 0) return -1;
     
-    if (!(*dir_entry & 0x1)) {
-        void *new_pt = get_next_avail(1);
-        if (!new_pt) return -1;
-        
-        memset(new_pt, 0, PAGE_SIZE);
-        *dir_entry = ((unsigned long)new_pt - (unsigned long)physical_memory) | 0x7;
+    pte_t locked = (pte & ~0xFFF) | PTE_LOCKED;
+    if (!__atomic_compare_exchange_n(pt_entry, &pte, locked, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        swap_free(&swap_store, slot);
+        return 1;
+    }
+    
+    // Pairs with page_acquire(): either the copier sees the owner gone and
+    // retranslates, or we see it busy and leave the page alone
+    __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_SEQ_CST);
+    int busy = __atomic_load_n(&frame_busy[frame], __ATOMIC_SEQ_CST) != 0;
+    
+    if (!busy) {
+        space_invalidate(s, vpn, 1);
+        if (swap_write(&swap_store, slot, physical_memory + (frame * PAGE_SIZE)) == 0) {
+            __atomic_store_n(pt_entry, ((pte_t)slot << OFFSET_BITS) | PTE_SWAPPED, __ATOMIC_RELEASE);
+            return 0;
+        }
     }
+    
+    __atomic_store_n(&frame_owner[frame], PAGE_OWNER(s, vpn), __ATOMIC_RELAXED);
+    __atomic_store_n(pt_entry, pte | PTE_ACCESSED, __ATOMIC_RELEASE);
+    swap_free(&swap_store, slot);
+    return busy ? 1 : -1;
+}
 
-    pte_t *page_table = (pte_t *)((*dir_entry & ~0xFFF) + (unsigned long)physical_memory);
-    pte_t *pt_entry = &page_table[page_idx];
+// Reclaim a frame by swapping out the page in it. CLOCK: a page accessed
+// since the hand last passed loses its accessed bit and gets another round.
+// The frame comes back still marked allocated, or -1 when swap is off,
+// full, or every page is in use.
+static long swap_out() {
+    if (!swap_enabled || __atomic_load_n(&swap_store.free_slots, __ATOMIC_RELAXED) == 0) return -1;
     
-    if (*pt_entry & 0x1) return -1;  // Already mapped
+    pthread_mutex_lock(&swap_mutex);
+    long victim = -1;
+    for (unsigned long n = 0; n < 2 * TOTAL_PHYSICAL_PAGES; n++) {
+        unsigned long frame = clock_hand;
+        clock_hand = (clock_hand + 1) % TOTAL_PHYSICAL_PAGES;
+        
+        unsigned long owner = __atomic_load_n(&frame_owner[frame], __ATOMIC_ACQUIRE);
+        if (!owner || owner == FRAME_SHARED) continue;
+        
+        // Spaces leave vm_spaces under swap_mutex before their tables go
+        struct vm_space *s = __atomic_load_n(&vm_spaces[owner / TOTAL_VIRTUAL_PAGES], __ATOMIC_ACQUIRE);
+        unsigned long vpn = owner % TOTAL_VIRTUAL_PAGES;
+        if (!s) continue;
+        pte_t *pt_entry = pte_slot(s->pgdir, (void *)(vpn * PAGE_SIZE), 0);
+        if (!pt_entry) continue;
+        pte_t pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+        if (!(pte & 0x1) || (pte >> OFFSET_BITS) != frame) continue;
+        
+        if (pte & PTE_ACCESSED) {
+            __atomic_fetch_and(pt_entry, ~(pte_t)PTE_ACCESSED, __ATOMIC_RELAXED);
+            tlb_invalidate(&tlb_store, s->asid, vpn);
+            continue;
+        }
+        
+        int ret = page_evict(s, pt_entry, pte, frame, vpn);
+        if (ret == 0) victim = frame;
+        if (ret <= 0) break;
+    }
+    pthread_mutex_unlock(&swap_mutex);
+    return victim;
+}
 
-    *pt_entry = ((unsigned long)pa - (unsigned long)physical_memory) | 0x7;
-    return 0;
+// Take pages from / give pages back to s's virtual address index; the
+// caller holds s->va_lock
+static unsigned long va_take(struct vm_space *s, unsigned long num_pages, unsigned long align) {
+    unsigned long vpn = align > 1 ? extent_alloc_aligned(s->va, num_pages, align)
+                                  : extent_alloc(s->va, num_pages);
+    if (vpn && s->vbitmap) bitmap_set_range(s->vbitmap, vpn, num_pages);
+    return vpn;
 }
 
-void *get_next_avail(int num_pages) {
+static void va_give(struct vm_space *s, unsigned long vpn, unsigned long num_pages) {
+    if (s->vbitmap) bitmap_clear_range(s->vbitmap, vpn, num_pages);
+    extent_free(s->va, vpn, num_pages);
+}
+
+// Return the magazine's cached ranges and chunk to s, the space they
+// came from
+static void mag_drain_va(struct vm_magazine *m, struct vm_space *s) {
+    pthread_mutex_lock(s->va_lock);
+    while (m->nranges) {
+        m->nranges--;
+        va_give(s, m->range_vpn[m->nranges], m->range_len[m->nranges]);
+    }
+    if (m->chunk_left) {
+        va_give(s, m->chunk_vpn, m->chunk_left);
+        m->chunk_left = 0;
+    }
+    pthread_mutex_unlock(s->va_lock);
+}
+
+// Hand a thread's cached frames and ranges back when it exits
+static void mag_release(void *arg) {
+    struct vm_magazine *m = (struct vm_magazine *)arg;
+    struct vm_space *s = space_mine();
+    
     pthread_mutex_lock(&virtual_mem_mutex);
+    while (m->nframes) {
+        unsigned long frame = m->frames[--m->nframes];
+        CLEAR_BIT(physical_bitmap, frame);
+        buddy_free(&frame_pool, frame, 0);
+    }
+    pthread_mutex_unlock(&virtual_mem_mutex);
+    mag_drain_va(m, s);
+    
+    if (s != &vm_default) __atomic_fetch_sub(&s->users, 1, __ATOMIC_RELEASE);
+    vm_current = &vm_default;
+    m->registered = 0;
+}
+
+static void mag_key_init(void) {
+    pthread_key_create(&vm_mag_key, mag_release);
+}
+
+static struct vm_magazine *mag_mine() {
+    if (!vm_mag.registered) {
+        pthread_once(&vm_mag_once, mag_key_init);
+        pthread_setspecific(vm_mag_key, &vm_mag);
+        vm_mag.registered = 1;
+    }
+    return &vm_mag;
+}
+
+// One frame from the thread's magazine, refilled a block at a time
+static long frame_get() {
+    struct vm_magazine *m = mag_mine();
     
-    for (size_t i = 1; i < TOTAL_PHYSICAL_PAGES; i++) {
-        if (!GET_BIT(physical_bitmap, i)) {
-            int found = 1;
-            for (int j = 1; j < num_pages && (i + j) < TOTAL_PHYSICAL_PAGES; j++) {
-                if (GET_BIT(physical_bitmap, i + j)) {
-                    found = 0;
-                    break;
-                }
+    if (m->nframes == 0) {
+        pthread_mutex_lock(&virtual_mem_mutex);
+        long run = buddy_alloc(&frame_pool, FRAME_MAG_ORDER);
+        if (run >= 0) {
+            bitmap_set_range(physical_bitmap, run, FRAME_MAG_BATCH);
+            for (int i = FRAME_MAG_BATCH - 1; i >= 0; i--) {
+                m->frames[m->nframes++] = run + i;
             }
-            
-            if (found) {
-                for (int j = 0; j < num_pages; j++) {
-                    SET_BIT(physical_bitmap, i + j);
-                }
-                pthread_mutex_unlock(&virtual_mem_mutex);
-                return physical_memory + (i * PAGE_SIZE);
+        } else {
+            // Too fragmented for a whole block: gather singles
+            while (m->nframes < FRAME_MAG_BATCH) {
+                long frame = buddy_alloc(&frame_pool, 0);
+                if (frame < 0) break;
+                SET_BIT(physical_bitmap, frame);
+                m->frames[m->nframes++] = frame;
             }
         }
+        pthread_mutex_unlock(&virtual_mem_mutex);
+        if (m->nframes == 0) {
+            // Pool exhausted: take the frame of a resident page instead
+            long frame = swap_out();
+            if (frame >= 0) frame_zero(frame);
+            return frame;
+        }
     }
     
-    pthread_mutex_unlock(&virtual_mem_mutex);
-    return NULL;
+    unsigned long frame = m->frames[--m->nframes];
+    frame_zero(frame);
+    return frame;
 }
 
-void *n_malloc(unsigned int num_bytes) {
-    if (!memory_initialized) {
-        set_physical_mem();
+// Cache a freed frame, draining the oldest half when the magazine is full
+static void frame_put(unsigned long frame) {
+    struct vm_magazine *m = mag_mine();
+    
+    if (m->nframes == FRAME_MAG_SIZE) {
+        pthread_mutex_lock(&virtual_mem_mutex);
+        for (int i = 0; i < FRAME_MAG_BATCH; i++) {
+            CLEAR_BIT(physical_bitmap, m->frames[i]);
+            buddy_free(&frame_pool, m->frames[i], 0);
+        }
+        pthread_mutex_unlock(&virtual_mem_mutex);
+        m->nframes -= FRAME_MAG_BATCH;
+        memmove(m->frames, m->frames + FRAME_MAG_BATCH, m->nframes * sizeof(unsigned long));
     }
-    if (num_bytes == 0) return NULL;
+    m->frames[m->nframes++] = frame;
+}
+
+static unsigned long va_get_global(struct vm_space *s, unsigned int num_pages, unsigned long align) {
+    pthread_mutex_lock(s->va_lock);
+    unsigned long vpn = va_take(s, num_pages, align);
+    pthread_mutex_unlock(s->va_lock);
+    return vpn;
+}
+
+static void va_put_global(struct vm_space *s, unsigned long vpn, unsigned int num_pages) {
+    pthread_mutex_lock(s->va_lock);
+    va_give(s, vpn, num_pages);
+    pthread_mutex_unlock(s->va_lock);
+}
+
+// Virtual pages in the current space. Small ranges come from the thread's
+// cache of freed ranges (exact size) or its private chunk; large ones from
+// the space's extent index.
+static unsigned long va_get(unsigned int num_pages) {
+    struct vm_space *s = space_mine();
+    if (num_pages > VA_MAG_MAX_PAGES) return va_get_global(s, num_pages, 1);
     
-    unsigned int num_pages = (num_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
-    void *va = NULL;
+    struct vm_magazine *m = mag_mine();
+    for (int i = m->nranges - 1; i >= 0; i--) {
+        if (m->range_len[i] == num_pages) {
+            unsigned long vpn = m->range_vpn[i];
+            m->nranges--;
+            m->range_vpn[i] = m->range_vpn[m->nranges];
+            m->range_len[i] = m->range_len[m->nranges];
+            return vpn;
+        }
+    }
+    
+    if (m->chunk_left < num_pages) {
+        pthread_mutex_lock(s->va_lock);
+        if (m->chunk_left) va_give(s, m->chunk_vpn, m->chunk_left);
+        m->chunk_vpn = va_take(s, VA_CHUNK_PAGES, 1);
+        m->chunk_left = m->chunk_vpn ? VA_CHUNK_PAGES : 0;
+        pthread_mutex_unlock(s->va_lock);
+        
+        // Not even a chunk left: try for the exact size
+        if (!m->chunk_left) return va_get_global(s, num_pages, 1);
+    }
+    
+    unsigned long vpn = m->chunk_vpn;
+    m->chunk_vpn += num_pages;
+    m->chunk_left -= num_pages;
+    return vpn;
+}
+
+static void va_put(unsigned long vpn, unsigned int num_pages) {
+    struct vm_space *s = space_mine();
+    if (num_pages > VA_MAG_MAX_PAGES) {
+        va_put_global(s, vpn, num_pages);
+        return;
+    }
+    
+    struct vm_magazine *m = mag_mine();
+    
+    // Freed right below the bump pointer: just take it back
+    if (m->chunk_left && vpn + num_pages == m->chunk_vpn) {
+        m->chunk_vpn = vpn;
+        m->chunk_left += num_pages;
+        return;
+    }
     
+    if (m->nranges == VA_MAG_SIZE) {
+        pthread_mutex_lock(s->va_lock);
+        for (int i = 0; i < VA_MAG_SIZE / 2; i++) {
+            va_give(s, m->range_vpn[i], m->range_len[i]);
+        }
+        pthread_mutex_unlock(s->va_lock);
+        m->nranges -= VA_MAG_SIZE / 2;
+        memmove(m->range_vpn, m->range_vpn + VA_MAG_SIZE / 2, m->nranges * sizeof(unsigned long));
+        memmove(m->range_len, m->range_len + VA_MAG_SIZE / 2, m->nranges * sizeof(unsigned int));
+    }
+    m->range_vpn[m->nranges] = vpn;
+    m->range_len[m->nranges] = num_pages;
+    m->nranges++;
+}
+
+// Contiguous run of num_pages frames from the buddy allocator
+void *get_next_avail(int num_pages) {
     pthread_mutex_lock(&virtual_mem_mutex);
-    for (size_t i = 1; i < TOTAL_VIRTUAL_PAGES; i++) {
-        if (!GET_BIT(virtual_bitmap, i)) {
-            int found = 1;
-            for (int j = 1; j < num_pages && (i + j) < TOTAL_VIRTUAL_PAGES; j++) {
-                if (GET_BIT(virtual_bitmap, i + j)) {
-                    found = 0;
-                    i += j;
-                    break;
-                }
-            }
-            
-            if (found) {
-                for (int j = 0; j < num_pages; j++) {
-                    SET_BIT(virtual_bitmap, i + j);
-                }
-                va = (void *)(i * PAGE_SIZE);
-                break;
-            }
+    
+    long frame = buddy_alloc_pages(&frame_pool, num_pages);
+    if (frame < 0) {
+        pthread_mutex_unlock(&virtual_mem_mutex);
+        
+        // A single frame can still be reclaimed from a resident page
+        if (num_pages != 1 || (frame = swap_out()) < 0) return NULL;
+        frame_zero(frame);
+        return physical_memory + (frame * PAGE_SIZE);
+    }
+    bitmap_set_range(physical_bitmap, frame, num_pages);
+    
+    pthread_mutex_unlock(&virtual_mem_mutex);
+    
+    for (int j = 0; j < num_pages; j++) {
+        frame_zero(frame + j);
+    }
+    return physical_memory + (frame * PAGE_SIZE);
+}
+
+// Return frames that were handed out but never mapped
+static void put_frames(void *pa, int num_pages) {
+    unsigned long frame = ((unsigned long)pa - (unsigned long)physical_memory) >> OFFSET_BITS;
+    
+    pthread_mutex_lock(&virtual_mem_mutex);
+    bitmap_clear_range(physical_bitmap, frame, num_pages);
+    buddy_free_pages(&frame_pool, frame, num_pages);
+    pthread_mutex_unlock(&virtual_mem_mutex);
+}
+
+static void free_pages(void *va, unsigned int num_pages);
+
+// Back and map num_pages pages at va. On failure the frames of the page
+// that failed are returned; the caller unwinds the pages already mapped.
+static int back_pages(void *va, unsigned int num_pages) {
+    pde_t *pgdir = space_mine()->pgdir;
+    
+    // Small requests are backed from the thread's frame magazine. Large
+    // ones take one contiguous run when the pool has one, otherwise
+    // single frames.
+    int small = num_pages <= FRAME_MAG_BATCH;
+    void *run = small ? NULL : get_next_avail(num_pages);
+
+    for (unsigned int i = 0; i < num_pages; i++) {
+        void *pa;
+        if (run) {
+            pa = run + (i * PAGE_SIZE);
+        } else if (small) {
+            long frame = frame_get();
+            pa = frame < 0 ? NULL : physical_memory + (frame * PAGE_SIZE);
+        } else {
+            pa = get_next_avail(1);
+        }
+        
+        if (!pa || map_page(pgdir, va + (i * PAGE_SIZE), pa) != 0) {
+            if (run) put_frames(run + (i * PAGE_SIZE), num_pages - i);
+            else if (pa) put_frames(pa, 1);
+            return -1;
         }
     }
+    
+    return 0;
+}
+
+// Page-granular allocation: reserve virtual pages, then back and map them
+static void *alloc_pages(unsigned int num_pages) {
+    unsigned long vpn = va_get(num_pages);
+    if (!vpn) return NULL;
+    void *va = (void *)(vpn * PAGE_SIZE);
+
+    if (back_pages(va, num_pages) != 0) {
+        free_pages(va, num_pages);
+        return NULL;
+    }
+    return va;
+}
+
+// Point dir_entry at entry (0, or a superpage) and return the frame of the
+// page table it held, -1 if none. Only for a 4 MB range the caller owns
+// whole, so no one maps into the table meanwhile. Holding swap_mutex
+// keeps a CLOCK sweep that read a stale frame_owner out of the table.
+static long table_unlink(pde_t *dir_entry, pde_t entry) {
+    pde_t pde = __atomic_load_n(dir_entry, __ATOMIC_ACQUIRE);
+    int table = (pde & 0x1) && !(pde & PDE_LARGE);
+    
+    if (table) pthread_mutex_lock(&swap_mutex);
+    __atomic_store_n(dir_entry, entry, __ATOMIC_RELEASE);
+    if (table) pthread_mutex_unlock(&swap_mutex);
+    return table ? (long)(pde >> OFFSET_BITS) : -1;
+}
+
+// Map one 4 MB-aligned superpage at va in s with a single directory
+// entry backed by one buddy block
+static int map_large(struct vm_space *s, void *va) {
+    pthread_mutex_lock(&virtual_mem_mutex);
+    long frame = buddy_alloc(&frame_pool, LARGE_PAGE_ORDER);
+    if (frame >= 0) bitmap_set_range(physical_bitmap, frame, LARGE_PAGE_FRAMES);
     pthread_mutex_unlock(&virtual_mem_mutex);
+    if (frame < 0) return -1;
+    
+    unsigned long vpn = GET_VPN(va);
+    for (unsigned long j = 0; j < LARGE_PAGE_FRAMES; j++) {
+        frame_zero(frame + j);
+        __atomic_store_n(&frame_owner[frame + j], PAGE_OWNER(s, vpn + j), __ATOMIC_RELAXED);
+    }
     
-    if (!va) return NULL;
+    // The range is ours, so a page table left here by earlier small
+    // mappings is empty and can go
+    pde_t *dir_entry = &s->pgdir[GET_PAGE_DIR_INDEX(va)];
+    long table = table_unlink(dir_entry, ((pde_t)frame << OFFSET_BITS) | PDE_LARGE | 0x7);
+    if (table >= 0) put_frames(physical_memory + (table * PAGE_SIZE), 1);
+    return 0;
+}
+
+// Large allocation: a 4 MB-aligned range whose whole 4 MB chunks are
+// superpages. The tail, and any chunk the buddy allocator can't supply
+// in one block, gets ordinary pages.
+static void *alloc_large(unsigned int num_pages) {
+    struct vm_space *s = space_mine();
+    unsigned long vpn = va_get_global(s, num_pages, LARGE_PAGE_FRAMES);
+    if (!vpn) return alloc_pages(num_pages);
+    void *va = (void *)(vpn * PAGE_SIZE);
+    
+    unsigned int i = 0;
+    while (i + LARGE_PAGE_FRAMES <= num_pages && map_large(s, va + (i * PAGE_SIZE)) == 0) {
+        i += LARGE_PAGE_FRAMES;
+    }
+    
+    if (i < num_pages && back_pages(va + (i * PAGE_SIZE), num_pages - i) != 0) {
+        free_pages(va, num_pages);
+        return NULL;
+    }
+    return va;
+}
+
+// Demand-paged allocation: reserve virtual pages and mark their entries,
+// leaving the frames to be allocated by translate() on first touch
+static void *reserve_pages(unsigned int num_pages) {
+    unsigned long vpn = va_get(num_pages);
+    if (!vpn) return NULL;
+    void *va = (void *)(vpn * PAGE_SIZE);
+    pde_t *pgdir = space_mine()->pgdir;
 
     for (unsigned int i = 0; i < num_pages; i++) {
-        void *pa = get_next_avail(1);
-        if (!pa || map_page(page_directory, va + (i * PAGE_SIZE), pa) != 0) {
-            n_free(va, i * PAGE_SIZE);
+        pte_t *pt_entry = pte_slot(pgdir, va + (i * PAGE_SIZE), 1);
+        if (!pt_entry) {
+            free_pages(va, num_pages);
             return NULL;
         }
+        __atomic_store_n(pt_entry, PTE_RESERVED, __ATOMIC_RELEASE);
     }
     
     return va;
 }
 
-void n_free(void *va, int size) {
-    if (!va || size <= 0) return;
+// Mark a frame whose page is being freed. Returns 0 if nothing holds it
+// and the caller frees it now, 1 if a holder will on its last release.
+// The caller has already cleared frame_owner, so no new hold can stick.
+static int frame_retire(unsigned long frame) {
+    if (__atomic_fetch_or(&frame_busy[frame], FRAME_RETIRED, __ATOMIC_SEQ_CST) != 0) return 1;
     
-    // Calculate number of pages
-    unsigned int num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    unsigned long start_vpn = (unsigned long)va / PAGE_SIZE;
+    // A holder that raced in and out may have freed it already
+    unsigned int expect = FRAME_RETIRED;
+    return !__atomic_compare_exchange_n(&frame_busy[frame], &expect, 0, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Drop one hold on a frame, freeing it if its page went away meanwhile
+static void frame_unhold(unsigned long frame) {
+    if (__atomic_sub_fetch(&frame_busy[frame], 1, __ATOMIC_ACQ_REL) != FRAME_RETIRED) return;
     
+    unsigned int expect = FRAME_RETIRED;
+    if (__atomic_compare_exchange_n(&frame_busy[frame], &expect, 0, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&virtual_mem_mutex);
+        CLEAR_BIT(physical_bitmap, frame);
+        buddy_free(&frame_pool, frame, 0);
+        pthread_mutex_unlock(&virtual_mem_mutex);
+    }
+}
+
+// Drop one mapping of a frame. Returns 1 if it was the last one.
+static int frame_unshare(unsigned long frame) {
+    unsigned int n = __atomic_load_n(&frame_shares[frame], __ATOMIC_ACQUIRE);
+    while (n && !__atomic_compare_exchange_n(&frame_shares[frame], &n, n - 1, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return n == 0;
+}
+
+// Free a frame whose last mapping is gone, unless something still holds it
+static void frame_drop(unsigned long frame) {
+    __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_SEQ_CST);
+    if (!frame_retire(frame)) frame_put(frame);
+}
+
+// Frames freed by a big unmap, as runs of adjacent frames. They go back to
+// the buddy allocator a batch at a time, so clearing entries holds no lock
+// and unmaps of different ranges run side by side.
+#define FREE_BATCH_RUNS 32
+
+struct free_batch {
+    int n;
+    unsigned long start[FREE_BATCH_RUNS];
+    unsigned long len[FREE_BATCH_RUNS];
+};
+
+static void batch_flush(struct free_batch *b) {
+    if (!b->n) return;
     pthread_mutex_lock(&virtual_mem_mutex);
+    for (int i = 0; i < b->n; i++) {
+        bitmap_clear_range(physical_bitmap, b->start[i], b->len[i]);
+        buddy_free_pages(&frame_pool, b->start[i], b->len[i]);
+    }
+    pthread_mutex_unlock(&virtual_mem_mutex);
+    b->n = 0;
+}
+
+static void batch_add(struct free_batch *b, unsigned long frame, unsigned long count) {
+    if (b->n && b->start[b->n - 1] + b->len[b->n - 1] == frame) {
+        b->len[b->n - 1] += count;
+        return;
+    }
+    if (b->n == FREE_BATCH_RUNS) batch_flush(b);
+    b->start[b->n] = frame;
+    b->len[b->n] = count;
+    b->n++;
+}
+
+// Clear the entries of num_pages pages at va in s and free what they map,
+// along with the page tables of every 4 MB the range covers whole. The
+// range is the caller's, so entries are cleared without a lock; cached
+// translations are left for the caller to invalidate.
+static void unmap_pages(struct vm_space *s, void *va, unsigned int num_pages) {
+    // Big frees go back to the buddy allocator in batches; small ones
+    // recycle through the thread's magazine
+    int bulk = num_pages > FRAME_MAG_BATCH;
+    struct free_batch batch;
+    batch.n = 0;
     
     // For each page
     for (unsigned int i = 0; i < num_pages; i++) {
@@ -235,37 +975,448 @@ void n_free(void *va, int size) {
         unsigned long page_idx = GET_PAGE_TABLE_INDEX(current_va);
         
         // Get directory entry
-        pde_t *dir_entry = &page_directory[dir_idx];
-        if (!(*dir_entry & 0x1)) continue;  // Not present
+        pde_t *dir_entry = &s->pgdir[dir_idx];
+        pde_t pde = __atomic_load_n(dir_entry, __ATOMIC_ACQUIRE);
+        if (!(pde & 0x1)) continue;  // Not present
+        
+        // Superpages go back whole; free_pages split any the range only
+        // partly covers
+        if (pde & PDE_LARGE) {
+            if (!bulk || page_idx != 0 || num_pages - i < LARGE_PAGE_FRAMES) continue;
+            unsigned long frame = (pde & ~0xFFF) >> OFFSET_BITS;
+            __atomic_store_n(dir_entry, 0, __ATOMIC_RELEASE);
+            for (unsigned long j = 0; j < LARGE_PAGE_FRAMES; j++) {
+                __atomic_store_n(&frame_owner[frame + j], 0, __ATOMIC_SEQ_CST);
+            }
+            // Free the block in runs around any pinned frames; with none
+            // pinned this is a single order-10 free
+            unsigned long run = frame;
+            for (unsigned long f = frame; f <= frame + LARGE_PAGE_FRAMES; f++) {
+                if (f < frame + LARGE_PAGE_FRAMES && !frame_retire(f)) continue;
+                if (f > run) batch_add(&batch, run, f - run);
+                run = f + 1;
+            }
+            i += LARGE_PAGE_FRAMES - 1;
+            continue;
+        }
         
         // Get page table
-        pte_t *page_table = (pte_t *)((*dir_entry & ~0xFFF) + (unsigned long)physical_memory);
+        pte_t *page_table = (pte_t *)((pde & ~0xFFF) + (unsigned long)physical_memory);
         pte_t *pt_entry = &page_table[page_idx];
         
-        if (*pt_entry & 0x1) {  // If page is present
-            // Get physical page number and clear physical bitmap
-            unsigned long ppn = (*pt_entry & ~0xFFF) >> OFFSET_BITS;
-            CLEAR_BIT(physical_bitmap, ppn);
+        // Clear the entry, first letting an in-flight swap of it finish
+        pte_t pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+        while ((pte & PTE_LOCKED) ||
+               !__atomic_compare_exchange_n(pt_entry, &pte, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (pte & PTE_LOCKED) {
+                sched_yield();
+                pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+            }
+        }
+        
+        if (pte & PTE_SWAPPED) {
+            swap_free(&swap_store, pte >> OFFSET_BITS);
+        } else if (pte & 0x1) {  // If page is present
+            unsigned long ppn = (pte & ~0xFFF) >> OFFSET_BITS;
+            
+            // A shared frame stays until its last mapping goes
+            if (!(pte & PTE_WRITE) && !frame_unshare(ppn)) continue;
+            __atomic_store_n(&frame_owner[ppn], 0, __ATOMIC_SEQ_CST);
             
-            // Clear page table entry
-            *pt_entry = 0;
+            if (frame_retire(ppn)) {
+                // Pinned: the last n_unpin frees it
+            } else if (bulk) {
+                batch_add(&batch, ppn, 1);
+            } else {
+                frame_put(ppn);
+            }
+        }
+    }
+    
+    // Tables whose whole 4 MB lay in the range are empty now
+    unsigned long first_vpn = GET_VPN(va);
+    unsigned long dir_first = (first_vpn + PAGE_TABLE_MASK) >> PAGE_TABLE_BITS;
+    unsigned long dir_end = (first_vpn + num_pages) >> PAGE_TABLE_BITS;
+    for (unsigned long d = dir_first; d < dir_end; d++) {
+        long table = table_unlink(&s->pgdir[d], 0);
+        if (table >= 0) batch_add(&batch, table, 1);
+    }
+    
+    batch_flush(&batch);
+}
+
+// Whether va is still handed out: mapped, reserved, swapped or inside a
+// superpage. Freed ranges have all-zero entries.
+static int page_live(struct vm_space *s, void *va) {
+    pde_t pde = __atomic_load_n(&s->pgdir[GET_PAGE_DIR_INDEX(va)], __ATOMIC_ACQUIRE);
+    if ((pde & 0x1) && (pde & PDE_LARGE)) return 1;
+    
+    pte_t *pt_entry = pte_slot(s->pgdir, va, 0);
+    return pt_entry && __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE) != 0;
+}
+
+static int split_large(struct vm_space *s, pde_t *dir_entry, void *va);
+
+static void free_pages(void *va, unsigned int num_pages) {
+    struct vm_space *s = space_mine();
+    unsigned long start_vpn = (unsigned long)va / PAGE_SIZE;
+    unsigned long end_vpn = start_vpn + num_pages;
+    
+    // Superpages only partly in the range are split first, so the part
+    // outside stays mapped and the part inside really goes. Without a
+    // table to split into, keep the whole range rather than leak its VAs.
+    void *last = (void *)((end_vpn - 1) * PAGE_SIZE);
+    if (((start_vpn % LARGE_PAGE_FRAMES) && split_large(s, &s->pgdir[GET_PAGE_DIR_INDEX(va)], va) != 0) ||
+        ((end_vpn % LARGE_PAGE_FRAMES) && split_large(s, &s->pgdir[GET_PAGE_DIR_INDEX(last)], last) != 0)) {
+        return;
+    }
+    
+    unmap_pages(s, va, num_pages);
+    
+    // Drop any cached translations for the whole range at once
+    space_invalidate(s, start_vpn, num_pages);
+    
+    // Hand the range back, merging with its neighbours in the space's index
+    va_put(start_vpn, num_pages);
+}
+
+static unsigned long slab_get_page(void) {
+    return (unsigned long)alloc_pages(1) / PAGE_SIZE;
+}
+
+static void slab_put_page(unsigned long vpn) {
+    free_pages((void *)(vpn * PAGE_SIZE), 1);
+}
+
+void *n_malloc(unsigned int num_bytes) {
+    if (!memory_initialized) {
+        set_physical_mem();
+    }
+    if (num_bytes == 0) return NULL;
+    
+    // Small objects share slab pages instead of taking a page each
+    if (num_bytes <= SLAB_MAX_SIZE) {
+        return (void *)slab_alloc(space_mine()->slab, num_bytes);
+    }
+    
+    unsigned int num_pages = (num_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (demand_paging) return reserve_pages(num_pages);
+    
+    // CLOCK only evicts 4 KB pages, so with swap on everything stays small
+    if (!swap_enabled && superpage_threshold && num_bytes >= superpage_threshold && num_pages >= LARGE_PAGE_FRAMES) {
+        return alloc_large(num_pages);
+    }
+    return alloc_pages(num_pages);
+}
+
+// Switch page-granular n_malloc between eager backing and demand paging.
+// Affects later allocations only; existing ones keep their mode.
+void set_demand_paging(int enabled) {
+    demand_paging = enabled != 0;
+}
+
+// Requests of at least num_bytes get superpages (0 disables them). Only
+// whole 4 MB chunks are mapped large, so values below that act as 4 MB.
+// Ignored once swap is on, since superpages can't be evicted.
+void set_superpage_threshold(unsigned int num_bytes) {
+    superpage_threshold = num_bytes;
+}
+
+// Back physical memory with a swap file of num_pages page slots. From then
+// on running out of frames evicts resident pages instead of failing, and
+// new allocations use 4 KB pages only. Superpages mapped before stay
+// resident.
+int set_swap(const char *path, unsigned long num_pages) {
+    // The slot number has to fit in the frame field of a PTE
+    if (num_pages == 0 || num_pages > (~(pte_t)0 >> OFFSET_BITS)) return -1;
+    
+    pthread_mutex_lock(&init_mutex);
+    int ret = -1;
+    if (!swap_enabled && swap_open(&swap_store, path, num_pages, PAGE_SIZE) == 0) {
+        swap_enabled = 1;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&init_mutex);
+    return ret;
+}
+
+void n_free(void *va, int size) {
+    if (!va || size <= 0) return;
+    
+    if ((unsigned int)size <= SLAB_MAX_SIZE && slab_free(space_mine()->slab, (unsigned long)va) == 0) return;
+    
+    // A repeated free would put the range in the caches twice and hand it
+    // to two owners; drop it here as the extent index would
+    if (!page_live(space_mine(), va)) return;
+    
+    free_pages(va, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+// New address space with nothing mapped, its frames coming from the same
+// pool as every other space's. NULL when the ASIDs or memory run out.
+struct vm_space *vm_space_create() {
+    if (!memory_initialized) {
+        set_physical_mem();
+    }
+    
+    struct vm_space *s = calloc(1, sizeof(struct vm_space));
+    if (!s) return NULL;
+    s->pgdir = (pde_t *)get_next_avail(1);
+    if (!s->pgdir || extent_init(&s->own_va, 1, TOTAL_VIRTUAL_PAGES - 1) != 0) {
+        if (s->pgdir) put_frames(s->pgdir, 1);
+        free(s);
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&space_mutex);
+    for (unsigned int asid = 1; asid < VM_MAX_SPACES && !s->asid; asid++) {
+        if (!GET_BIT(vm_asids, asid)) {
+            SET_BIT(vm_asids, asid);
+            s->asid = asid;
+        }
+    }
+    pthread_mutex_unlock(&space_mutex);
+    if (!s->asid) {
+        extent_destroy(&s->own_va);
+        put_frames(s->pgdir, 1);
+        free(s);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&s->own_lock, NULL);
+    slab_init(&s->own_slab, PAGE_SIZE, slab_get_page, slab_put_page);
+    s->va = &s->own_va;
+    s->va_lock = &s->own_lock;
+    s->slab = &s->own_slab;
+    __atomic_store_n(&vm_spaces[s->asid], s, __ATOMIC_RELEASE);
+    return s;
+}
+
+// Free every page of a space along with the space. Fails (-1) on the
+// default space and on one that is still current on some thread.
+int vm_space_destroy(struct vm_space *s) {
+    if (!s || s == &vm_default || __atomic_load_n(&s->users, __ATOMIC_ACQUIRE) != 0) return -1;
+    
+    // Out of swap's sight first, so no eviction walks the tables below
+    pthread_mutex_lock(&swap_mutex);
+    __atomic_store_n(&vm_spaces[s->asid], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&swap_mutex);
+    
+    // Unmapping a table's whole range frees the table too
+    unsigned long dir_entries = 1UL << PAGE_DIR_BITS;
+    unsigned long table_pages = 1UL << PAGE_TABLE_BITS;
+    for (unsigned long d = 0; d < dir_entries; d++) {
+        if (!(s->pgdir[d] & 0x1)) continue;
+        unmap_pages(s, (void *)(d * table_pages * PAGE_SIZE), table_pages);
+    }
+    put_frames(s->pgdir, 1);
+    
+    // The ASID's translations have to be gone before it is handed out again
+    tlb_flush_asid(&tlb_store, s->asid);
+    tlb_flush_asid(&tlb_large, s->asid);
+    __atomic_fetch_add(&tlb_epoch, 1, __ATOMIC_RELEASE);
+    
+    slab_destroy(&s->own_slab);
+    extent_destroy(&s->own_va);
+    pthread_mutex_destroy(&s->own_lock);
+    
+    pthread_mutex_lock(&space_mutex);
+    CLEAR_BIT(vm_asids, s->asid);
+    pthread_mutex_unlock(&space_mutex);
+    free(s);
+    return 0;
+}
+
+// Make s (NULL: the default space) the calling thread's current space and
+// return the one it replaces. Cached translations of both stay in the TLB.
+struct vm_space *vm_space_switch(struct vm_space *s) {
+    struct vm_space *old = space_mine();
+    if (!s) s = &vm_default;
+    if (s == old) return old;
+    
+    // The thread's cached ranges belong to the space it is leaving
+    struct vm_magazine *m = mag_mine();
+    mag_drain_va(m, old);
+    
+    if (s != &vm_default) __atomic_fetch_add(&s->users, 1, __ATOMIC_ACQ_REL);
+    if (old != &vm_default) __atomic_fetch_sub(&old->users, 1, __ATOMIC_ACQ_REL);
+    vm_current = s;
+    return old;
+}
+
+struct vm_space *vm_space_current() {
+    return space_mine();
+}
+
+// Turn the superpage at dir_entry into a page table of small entries over
+// the same frames, so its pages can be shared or freed one by one
+static int split_large(struct vm_space *s, pde_t *dir_entry, void *va) {
+    pde_t pde = __atomic_load_n(dir_entry, __ATOMIC_ACQUIRE);
+    if (!(pde & 0x1) || !(pde & PDE_LARGE)) return 0;
+    
+    pte_t *table = (pte_t *)get_next_avail(1);
+    if (!table) return -1;
+    unsigned long frame = pde >> OFFSET_BITS;
+    for (unsigned long j = 0; j < LARGE_PAGE_FRAMES; j++) {
+        table[j] = ((pte_t)(frame + j) << OFFSET_BITS) | 0x7 | PTE_ACCESSED;
+    }
+    
+    pde_t small = ((unsigned long)table - (unsigned long)physical_memory) | 0x7;
+    if (!__atomic_compare_exchange_n(dir_entry, &pde, small, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        put_frames(table, 1);
+        return 0;
+    }
+    space_invalidate(s, GET_VPN(va) & ~(LARGE_PAGE_FRAMES - 1), LARGE_PAGE_FRAMES);
+    return 0;
+}
+
+// Share the page at src_va with the empty entry dst of dst_va, both
+// read-only after. A page that is held (pinned or mid-copy) is copied
+// instead, since a holder may be writing to it, and one in swap gets a
+// copy of its slot.
+static int fork_page(struct vm_space *s, void *src_va, void *dst_va, pte_t *dst) {
+    pte_t *src = pte_slot(s->pgdir, src_va, 0);
+    if (!src) return 0;
+    
+    for (;;) {
+        pte_t pte = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+        if (pte & PTE_LOCKED) {
+            sched_yield();
+            continue;
+        }
+        if (pte & PTE_SWAPPED) {
+            // Copied slot to slot, locked so it can't be swapped in meanwhile
+            pte_t locked = (pte & ~0xFFF) | PTE_LOCKED;
+            if (!__atomic_compare_exchange_n(src, &pte, locked, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) continue;
+            long slot = swap_alloc(&swap_store);
+            char page[PAGE_SIZE];
+            int ok = slot >= 0 &&
+                     swap_read(&swap_store, pte >> OFFSET_BITS, page) == 0 &&
+                     swap_write(&swap_store, slot, page) == 0;
+            __atomic_store_n(src, pte, __ATOMIC_RELEASE);
+            if (!ok) {
+                if (slot >= 0) swap_free(&swap_store, slot);
+                return -1;
+            }
+            *dst = ((pte_t)slot << OFFSET_BITS) | PTE_SWAPPED;
+            return 0;
+        }
+        if (!(pte & 0x1)) {
+            // Unbacked demand-paged pages fault in separately on each side
+            *dst = pte & PTE_RESERVED;
+            return 0;
+        }
+        
+        unsigned long frame = pte >> OFFSET_BITS;
+        if (pte & PTE_WRITE) {
+            pte_t ro = pte & ~(pte_t)PTE_WRITE;
+            if (!__atomic_compare_exchange_n(src, &pte, ro, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) continue;
             
-            // Clear TLB entry if present
-            pthread_mutex_lock(&tlb_mutex);
-            unsigned long vpn = GET_VPN(current_va);
-            for (int j = 0; j < TLB_ENTRIES; j++) {
-                if (tlb_store.valid[j] && tlb_store.vpn[j] == vpn) {
-                    tlb_store.valid[j] = 0;
-                }
+            // Pairs with page_hold(): a writer either sees the owner
+            // change and retranslates, or we see its hold
+            __atomic_store_n(&frame_owner[frame], FRAME_SHARED, __ATOMIC_SEQ_CST);
+            space_invalidate(s, GET_VPN(src_va), 1);
+            if (__atomic_load_n(&frame_busy[frame], __ATOMIC_SEQ_CST) != 0) {
+                __atomic_store_n(&frame_owner[frame], PAGE_OWNER(s, GET_VPN(src_va)), __ATOMIC_SEQ_CST);
+                __atomic_store_n(src, pte, __ATOMIC_RELEASE);
+                
+                long copy = frame_get();
+                if (copy < 0) return -1;
+                memcpy(physical_memory + (copy * PAGE_SIZE), physical_memory + (frame * PAGE_SIZE), PAGE_SIZE);
+                __atomic_store_n(&frame_owner[copy], PAGE_OWNER(s, GET_VPN(dst_va)), __ATOMIC_RELAXED);
+                *dst = ((pte_t)copy << OFFSET_BITS) | 0x7;
+                return 0;
             }
-            pthread_mutex_unlock(&tlb_mutex);
         }
         
-        // Clear virtual bitmap
-        CLEAR_BIT(virtual_bitmap, start_vpn + i);
+        __atomic_fetch_add(&frame_shares[frame], 1, __ATOMIC_ACQ_REL);
+        *dst = ((pte_t)frame << OFFSET_BITS) | (0x7 & ~PTE_WRITE);
+        return 0;
     }
+}
+
+// Copy-on-write snapshot of num_bytes at va: a new range that shares
+// every frame with the original until either side writes to a page. Costs
+// one entry per page instead of a copy of the data. Page-granular ranges
+// only; small (slab) objects are simply copied.
+void *n_fork(void *va, unsigned int num_bytes) {
+    if (!va || num_bytes == 0) return NULL;
     
-    pthread_mutex_unlock(&virtual_mem_mutex);
+    if (num_bytes <= SLAB_MAX_SIZE) {
+        void *copy = n_malloc(num_bytes);
+        if (copy && n_memcpy(copy, va, num_bytes) != 0) {
+            n_free(copy, num_bytes);
+            copy = NULL;
+        }
+        return copy;
+    }
+    if (GET_OFFSET(va)) return NULL;
+    
+    unsigned int num_pages = (num_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned long vpn = va_get(num_pages);
+    if (!vpn) return NULL;
+    void *fork_va = (void *)(vpn * PAGE_SIZE);
+    struct vm_space *s = space_mine();
+    __atomic_store_n(&cow_active, 1, __ATOMIC_SEQ_CST);
+    
+    pthread_mutex_lock(&cow_mutex);
+    int ret = 0;
+    for (unsigned int i = 0; i < num_pages && ret == 0; i++) {
+        void *src_va = (char *)va + (i * PAGE_SIZE);
+        void *dst_va = (char *)fork_va + (i * PAGE_SIZE);
+        pte_t *dst = pte_slot(s->pgdir, dst_va, 1);
+        if (!dst || split_large(s, &s->pgdir[GET_PAGE_DIR_INDEX(src_va)], src_va) != 0) {
+            ret = -1;
+            break;
+        }
+        ret = fork_page(s, src_va, dst_va, dst);
+    }
+    pthread_mutex_unlock(&cow_mutex);
+    
+    if (ret != 0) {
+        free_pages(fork_va, num_pages);
+        return NULL;
+    }
+    return fork_va;
+}
+
+// Translate va and hold its frame until frame_unhold(): a held frame is
+// neither evicted nor freed. The owner check after taking the hold
+// catches an eviction or free that raced the translation, and for a
+// write, an n_fork that made the page shared.
+static pte_t *page_hold(struct vm_space *s, void *va, unsigned long *frame, int write) {
+    for (;;) {
+        pte_t *pa = walk(s, va, write);
+        if (!pa) return NULL;
+        
+        unsigned long f = ((unsigned long)pa - (unsigned long)physical_memory) >> OFFSET_BITS;
+        __atomic_fetch_add(&frame_busy[f], 1, __ATOMIC_SEQ_CST);
+        unsigned long owner = __atomic_load_n(&frame_owner[f], __ATOMIC_SEQ_CST);
+        if (owner == PAGE_OWNER(s, GET_VPN(va)) || (!write && owner == FRAME_SHARED)) {
+            *frame = f;
+            return pa;
+        }
+        frame_unhold(f);
+    }
+}
+
+// Translate va for a copy. With swap or sharing in play, the frame is
+// held until page_release() so it can't be evicted or shared mid-copy.
+static pte_t *page_acquire(void *va, long *frame, int write) {
+    struct vm_space *s = space_mine();
+    *frame = -1;
+    if (!swap_enabled && !__atomic_load_n(&cow_active, __ATOMIC_ACQUIRE)) {
+        return walk(s, va, write);
+    }
+    
+    unsigned long f;
+    pte_t *pa = page_hold(s, va, &f, write);
+    if (pa) *frame = f;
+    return pa;
+}
+
+static void page_release(long frame) {
+    if (frame >= 0) frame_unhold(frame);
 }
 
 int put_data(void *va, void *val, int size) {
@@ -277,13 +1428,15 @@ int put_data(void *va, void *val, int size) {
     
     while (remaining > 0) {
         void *curr_va = (void *)((unsigned long)va + src_offset);
-        pte_t *pa = translate(page_directory, curr_va);
+        long frame;
+        pte_t *pa = page_acquire(curr_va, &frame, 1);
         if (!pa) return -1;
         
         int chunk = PAGE_SIZE - offset;
         if (chunk > remaining) chunk = remaining;
         
         memcpy(pa, (char *)val + src_offset, chunk);
+        page_release(frame);
         remaining -= chunk;
         src_offset += chunk;
         offset = 0;
@@ -302,90 +1455,472 @@ void get_data(void *va, void *val, int size) {
     
     while (remaining > 0) {
         void *curr_va = (void *)((unsigned long)va + dst_offset);
-        pte_t *pa = translate(page_directory, curr_va);
+        long frame;
+        pte_t *pa = page_acquire(curr_va, &frame, 0);
         if (!pa) return;
         
         int chunk = PAGE_SIZE - offset;
         if (chunk > remaining) chunk = remaining;
         
         memcpy((char *)val + dst_offset, pa, chunk);
+        page_release(frame);
         remaining -= chunk;
         dst_offset += chunk;
         offset = 0;
     }
 }
 
-void mat_mult(void *mat1, void *mat2, int size, void *answer) {
-    int *buffer1 = malloc(size * size * sizeof(int));
-    int *buffer2 = malloc(size * size * sizeof(int));
-    int *result = malloc(size * size * sizeof(int));
-    
-    if (!buffer1 || !buffer2 || !result) {
-        free(buffer1);
-        free(buffer2);
-        free(result);
-        return;
+// Page-sized piece of a put_data_v / get_data_v descriptor
+struct iov_piece {
+    unsigned long va;
+    char *buf;
+    unsigned int len;
+    unsigned int seq;       // Position in the batch, keeps same-page order stable
+};
+
+// The page the batch is currently on, held across consecutive pieces
+struct page_cursor {
+    unsigned long vpn;
+    char *page;
+    long frame;
+};
+
+static int piece_cmp(const void *a, const void *b) {
+    const struct iov_piece *x = (const struct iov_piece *)a, *y = (const struct iov_piece *)b;
+    unsigned long vx = GET_VPN(x->va), vy = GET_VPN(y->va);
+    if (vx != vy) return vx < vy ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Copy one piece, translating only when it's on a different page than
+// the last one
+static int move_piece(struct page_cursor *c, unsigned long va, char *buf, unsigned int len, int write) {
+    if (!c->page || GET_VPN(va) != c->vpn) {
+        page_release(c->frame);
+        c->frame = -1;
+        pte_t *pa = page_acquire((void *)va, &c->frame, write);
+        if (!pa) {
+            c->page = NULL;
+            return -1;
+        }
+        c->vpn = GET_VPN(va);
+        c->page = (char *)pa - GET_OFFSET(va);
     }
-    
-    get_data(mat1, buffer1, size * size * sizeof(int));
-    get_data(mat2, buffer2, size * size * sizeof(int));
-    
-    for (int i = 0; i < size; i++) {
-        for (int j = 0; j < size; j++) {
-            result[i * size + j] = 0;
-            for (int k = 0; k < size; k++) {
-                result[i * size + j] += buffer1[i * size + k] * buffer2[k * size + j];
+
+    if (write) memcpy(c->page + GET_OFFSET(va), buf, len);
+    else memcpy(buf, c->page + GET_OFFSET(va), len);
+    return 0;
+}
+
+// Run a batch of descriptors one page at a time. Batches already in page
+// order stream straight through; others are split into per-page pieces and
+// sorted so each distinct page is translated once.
+static int data_v(struct vm_iov *iov, int count, int write) {
+    struct page_cursor c = { 0, NULL, -1 };
+    unsigned long npieces = 0, last = 0;
+    int sorted = 1, ret = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (!iov[i].va || !iov[i].buf) return -1;
+        if (!iov[i].len) continue;
+        unsigned long first = GET_VPN(iov[i].va);
+        if (first < last) sorted = 0;
+        last = GET_VPN((unsigned long)iov[i].va + iov[i].len - 1);
+        npieces += last - first + 1;
+    }
+
+    struct iov_piece *pieces = NULL;
+    if (!sorted) {
+        pieces = malloc(npieces * sizeof(struct iov_piece));
+        if (!pieces) return -1;
+    }
+
+    unsigned long n = 0;
+    for (int i = 0; i < count && ret == 0; i++) {
+        unsigned long va = (unsigned long)iov[i].va;
+        char *buf = (char *)iov[i].buf;
+        unsigned int left = iov[i].len;
+
+        while (left > 0) {
+            unsigned int chunk = PAGE_SIZE - GET_OFFSET(va);
+            if (chunk > left) chunk = left;
+
+            if (sorted) {
+                ret = move_piece(&c, va, buf, chunk, write);
+                if (ret) break;
+            } else {
+                pieces[n].va = va;
+                pieces[n].buf = buf;
+                pieces[n].len = chunk;
+                pieces[n].seq = n;
+                n++;
             }
+            va += chunk;
+            buf += chunk;
+            left -= chunk;
+        }
+    }
+
+    if (!sorted) {
+        qsort(pieces, n, sizeof(struct iov_piece), piece_cmp);
+        for (unsigned long k = 0; k < n && ret == 0; k++) {
+            ret = move_piece(&c, pieces[k].va, pieces[k].buf, pieces[k].len, write);
         }
+        free(pieces);
     }
+
+    page_release(c.frame);
+    return ret;
+}
+
+int put_data_v(struct vm_iov *iov, int count) {
+    if (!iov || count < 0) return -1;
+    return data_v(iov, count, 1);
+}
+
+int get_data_v(struct vm_iov *iov, int count) {
+    if (!iov || count < 0) return -1;
+    return data_v(iov, count, 0);
+}
+
+// Pin the frames behind [va, va + len) and describe them in out[] as host
+// pointers, merging frames that are adjacent in physical memory. Pinned
+// frames stay put: swap skips them, and an n_free of the range leaves
+// them allocated until n_unpin. Returns the number of entries used, or
+// -1 if part of the range is unmapped or it needs more than max entries.
+// A write pin breaks copy-on-write sharing first; a read pin doesn't.
+static int pin_range(void *va, unsigned int len, struct iovec *out, int max, int write) {
+    if (!va || !out || max <= 0) return -1;
     
-    put_data(answer, result, size * size * sizeof(int));
+    struct vm_space *s = space_mine();
+    unsigned long addr = (unsigned long)va;
+    unsigned long end = addr + len;
+    int n = 0;
     
-    free(buffer1);
-    free(buffer2);
-    free(result);
+    while (addr < end) {
+        unsigned long frame;
+        pte_t *pa = page_hold(s, (void *)addr, &frame, write);
+        unsigned long chunk = PAGE_SIZE - GET_OFFSET(addr);
+        if (chunk > end - addr) chunk = end - addr;
+        
+        if (pa && n > 0 && (char *)out[n - 1].iov_base + out[n - 1].iov_len == (char *)pa) {
+            out[n - 1].iov_len += chunk;
+        } else if (pa && n < max) {
+            out[n].iov_base = pa;
+            out[n].iov_len = chunk;
+            n++;
+        } else {
+            if (pa) frame_unhold(frame);
+            n_unpin(out, n);
+            return -1;
+        }
+        addr += chunk;
+    }
+    
+    return n;
 }
 
+// Pin for writing through the host pointers
+int n_pin(void *va, unsigned int len, struct iovec *out, int max) {
+    return pin_range(va, len, out, max, 1);
+}
 
-int TLB_add(void *va, void *pa) {
-    pthread_mutex_lock(&tlb_mutex);
+// Pin for reading only: pages shared by n_fork stay shared, and the view
+// keeps the data as of the pin if this space writes the page later
+int n_pin_read(void *va, unsigned int len, struct iovec *out, int max) {
+    return pin_range(va, len, out, max, 0);
+}
+
+// Release the pins taken by an n_pin that filled count entries of iov
+void n_unpin(struct iovec *iov, int count) {
+    for (int i = 0; i < count; i++) {
+        unsigned long start = (unsigned long)iov[i].iov_base - (unsigned long)physical_memory;
+        unsigned long last = start + iov[i].iov_len - 1;
+        
+        for (unsigned long frame = start >> OFFSET_BITS; frame <= last >> OFFSET_BITS; frame++) {
+            frame_unhold(frame);
+        }
+    }
+}
+
+// Move len bytes between two virtual ranges frame to frame. Each side is
+// translated once per page, and every chunk lies within one page on both
+// sides. backward walks from the end, for overlapping moves upwards.
+static int copy_range(void *dst_va, void *src_va, unsigned long len, int backward) {
+    char *src = NULL, *dst = NULL;
+    unsigned long src_left = 0, dst_left = 0;
+    long src_frame = -1, dst_frame = -1;
+    int ret = 0;
+
+    while (len > 0) {
+        if (!src_left) {
+            page_release(src_frame);
+            void *va = (char *)src_va + (backward ? len - 1 : 0);
+            src = (char *)page_acquire(va, &src_frame, 0);
+            if (!src) goto fail;
+            src_left = backward ? GET_OFFSET(va) + 1 : PAGE_SIZE - GET_OFFSET(va);
+            if (backward) src++;
+        }
+        if (!dst_left) {
+            page_release(dst_frame);
+            void *va = (char *)dst_va + (backward ? len - 1 : 0);
+            dst = (char *)page_acquire(va, &dst_frame, 1);
+            if (!dst) goto fail;
+            dst_left = backward ? GET_OFFSET(va) + 1 : PAGE_SIZE - GET_OFFSET(va);
+            if (backward) dst++;
+        }
+
+        unsigned long chunk = src_left < dst_left ? src_left : dst_left;
+        if (chunk > len) chunk = len;
+
+        if (backward) {
+            src -= chunk;
+            dst -= chunk;
+            memmove(dst, src, chunk);
+        } else {
+            memmove(dst, src, chunk);
+            src += chunk;
+            dst += chunk;
+            src_va = (char *)src_va + chunk;
+            dst_va = (char *)dst_va + chunk;
+        }
+        src_left -= chunk;
+        dst_left -= chunk;
+        len -= chunk;
+    }
+    goto out;
+
+fail:
+    ret = -1;
+out:
+    page_release(src_frame);
+    page_release(dst_frame);
+    return ret;
+}
+
+int n_memcpy(void *dst_va, void *src_va, unsigned int len) {
+    if (!dst_va || !src_va) return -1;
+    return copy_range(dst_va, src_va, len, 0);
+}
+
+// Overlap-safe: copies from the end when dst lies inside the source
+int n_memmove(void *dst_va, void *src_va, unsigned int len) {
+    if (!dst_va || !src_va) return -1;
+    int backward = (unsigned long)dst_va > (unsigned long)src_va &&
+                   (unsigned long)dst_va < (unsigned long)src_va + len;
+    return copy_range(dst_va, src_va, len, backward);
+}
+
+int n_memset(void *va, int c, unsigned int len) {
+    if (!va) return -1;
+
+    while (len > 0) {
+        long frame;
+        pte_t *pa = page_acquire(va, &frame, 1);
+        if (!pa) return -1;
+
+        unsigned long chunk = PAGE_SIZE - GET_OFFSET(va);
+        if (chunk > len) chunk = len;
+
+        memset(pa, c, chunk);
+        page_release(frame);
+        va = (char *)va + chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Tile by tile through gemm.c, so scratch stays a few tiles in size
+void mat_mult(void *mat1, void *mat2, int size, void *answer) {
+    struct gemm_vm g = { mat1, mat2, answer, size, get_data, put_data, NULL, NULL };
+    gemm_vm(&g);
+}
+
+// Pool workers are shared by every space, so each tile switches its worker
+// into the caller's space and back
+static void *space_bind(void *s) {
+    return vm_space_switch((struct vm_space *)s);
+}
+
+// mat_mult with the output tiles shared out over nthreads pool workers
+// (0 or less: one per CPU)
+void mat_mult_parallel(void *mat1, void *mat2, int size, void *answer, int nthreads) {
+    struct gemm_vm g = { mat1, mat2, answer, size, get_data, put_data, vm_space_current(), space_bind };
+    gemm_vm_parallel(&g, nthreads);
+}
+
+
+static struct tlb_stat *tlb_stat_mine() {
+    if (tlb_stat_slot < 0) {
+        tlb_stat_slot = __atomic_fetch_add(&tlb_stat_next, 1, __ATOMIC_RELAXED) % TLB_STAT_STRIPES;
+    }
+    return &tlb_stats[tlb_stat_slot];
+}
+
+// Superpage fill: one entry in tlb_large covers the whole 4 MB
+static void tlb_add_large(struct vm_space *s, void *va, unsigned long ppn) {
+    unsigned long vpn = GET_VPN(va);
+    unsigned long base = ppn & ~(LARGE_PAGE_FRAMES - 1);
+    struct tlb_gen gen;
+    struct tlb_entry *slot = tlb_reserve(&tlb_large, s->asid, vpn >> LARGE_PAGE_ORDER, &gen);
     
+    pde_t pde = __atomic_load_n(&s->pgdir[GET_PAGE_DIR_INDEX(va)], __ATOMIC_RELAXED);
+    if ((pde & 0x1) && (pde & PDE_LARGE) && (pde >> OFFSET_BITS) == base) {
+        tlb_fill(&tlb_large, slot, s->asid, vpn >> LARGE_PAGE_ORDER, base, gen);
+        tlb_l1_insert(&tlb_l1, s->asid, vpn, ppn);
+        return;
+    }
+    
+    tlb_release(slot);
+}
+
+// Neither fills nor lookups take a global lock
+static void tlb_add(struct vm_space *s, void *va, void *pa) {
     unsigned long vpn = GET_VPN(va);
     unsigned long ppn = ((unsigned long)pa - (unsigned long)physical_memory) >> OFFSET_BITS;
-    unsigned long index = vpn % TLB_ENTRIES;
     
-    tlb_store.vpn[index] = vpn;
-    tlb_store.ppn[index] = ppn;
-    tlb_store.valid[index] = 1;
+    pde_t pde = __atomic_load_n(&s->pgdir[GET_PAGE_DIR_INDEX(va)], __ATOMIC_RELAXED);
+    if (pde & PDE_LARGE) {
+        tlb_add_large(s, va, ppn);
+        return;
+    }
     
-    pthread_mutex_unlock(&tlb_mutex);
+    struct tlb_gen gen;
+    struct tlb_entry *slot = tlb_reserve(&tlb_store, s->asid, vpn, &gen);
+
+    // Frees clear the PTE before invalidating, and invalidation either
+    // waits for reserved slots or bumps a generation sampled after the
+    // reserve, so re-checking here keeps a racing walk from caching a
+    // freed page
+    pde = __atomic_load_n(&s->pgdir[GET_PAGE_DIR_INDEX(va)], __ATOMIC_RELAXED);
+    if ((pde & 0x1) && !(pde & PDE_LARGE)) {
+        pte_t *page_table = (pte_t *)((pde & ~0xFFF) + (unsigned long)physical_memory);
+        pte_t pte = __atomic_load_n(&page_table[GET_PAGE_TABLE_INDEX(va)], __ATOMIC_RELAXED);
+        if ((pte & 0x1) && (pte >> OFFSET_BITS) == ppn) {
+            if (!(pte & PTE_WRITE)) ppn |= TLB_READONLY;
+            tlb_fill(&tlb_store, slot, s->asid, vpn, ppn, gen);
+            tlb_l1_insert(&tlb_l1, s->asid, vpn, ppn);
+            return;
+        }
+    }
+    
+    tlb_release(slot);
+}
+
+// Cache the translation of va in the current space
+int TLB_add(void *va, void *pa) {
+    tlb_add(space_mine(), va, pa);
     return 0;
 }
 
-pte_t *TLB_check(void *va) {
-    pthread_mutex_lock(&tlb_mutex);
-    
+// Cached translation of va in s. A write skips read-only (shared) entries
+// so the walk gets to break the sharing.
+static pte_t *tlb_check(struct vm_space *s, void *va, int write) {
+    struct tlb_stat *stat = tlb_stat_mine();
     unsigned long vpn = GET_VPN(va);
-    unsigned long index = vpn % TLB_ENTRIES;
+    unsigned long ppn;
+    int hit = 0;
     
-    if (tlb_store.valid[index] && tlb_store.vpn[index] == vpn) {
-        tlb_hits++;
-        void *pa = physical_memory + (tlb_store.ppn[index] << OFFSET_BITS);
-        pthread_mutex_unlock(&tlb_mutex);
-        return (pte_t *)pa;
+    // The epoch is read before any lookup, so an entry cached from here on
+    // is tagged no newer than the shootdown it might have missed
+    tlb_l1_sync(&tlb_l1, __atomic_load_n(&tlb_epoch, __ATOMIC_ACQUIRE));
+    if (tlb_l1_lookup(&tlb_l1, s->asid, vpn, &ppn)) {
+        hit = 1;
+        __atomic_fetch_add(&stat->l1_hits, 1, __ATOMIC_RELAXED);
+    } else if (tlb_lookup(&tlb_store, s->asid, vpn, &ppn)) {
+        hit = 1;
+        tlb_l1_insert(&tlb_l1, s->asid, vpn, ppn);
+    } else if (tlb_lookup(&tlb_large, s->asid, vpn >> LARGE_PAGE_ORDER, &ppn)) {
+        hit = 1;
+        ppn += vpn & (LARGE_PAGE_FRAMES - 1);
+        tlb_l1_insert(&tlb_l1, s->asid, vpn, ppn);
+        __atomic_fetch_add(&stat->large_hits, 1, __ATOMIC_RELAXED);
     }
     
-    tlb_misses++;
+    if (!hit || (write && (ppn & TLB_READONLY))) {
+        __atomic_fetch_add(&stat->misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    
+    __atomic_fetch_add(&stat->hits, 1, __ATOMIC_RELAXED);
+    ppn &= ~TLB_READONLY;
+    return (pte_t *)(physical_memory + (ppn << OFFSET_BITS) + GET_OFFSET(va));
+}
+
+pte_t *TLB_check(void *va) {
+    return tlb_check(space_mine(), va, 0);
+}
+
+// Invalidate s's translations of npages pages from vpn, in the shared
+// TLBs and (via the shootdown epoch) in every thread's L1
+static void space_invalidate(struct vm_space *s, unsigned long vpn, unsigned long npages) {
+    unsigned long first = vpn >> LARGE_PAGE_ORDER;
+    unsigned long last = (vpn + npages - 1) >> LARGE_PAGE_ORDER;
+    tlb_invalidate_range(&tlb_store, s->asid, vpn, npages);
+    tlb_invalidate_range(&tlb_large, s->asid, first, last - first + 1);
+    __atomic_fetch_add(&tlb_epoch, 1, __ATOMIC_RELEASE);
+}
+
+// Invalidate the translations of npages pages starting at va in the
+// current space
+void TLB_invalidate_range(void *va, unsigned long npages) {
+    space_invalidate(space_mine(), GET_VPN(va), npages);
+}
+
+// Select TLB size, associativity and replacement policy. May be called
+// before or after set_physical_mem(); a live TLB is flushed and rebuilt,
+// so no other thread may be translating at the time.
+int TLB_configure(unsigned int entries, unsigned int ways, int policy) {
+    struct tlb fresh;
+    if (tlb_init(&fresh, entries, ways, policy) != 0) return -1;
+
+    pthread_mutex_lock(&init_mutex);
+    pthread_mutex_lock(&tlb_mutex);
+    tlb_entries = entries;
+    tlb_ways = ways;
+    tlb_policy = policy;
+    if (memory_initialized) {
+        tlb_destroy(&tlb_store);
+        tlb_store = fresh;
+        __atomic_fetch_add(&tlb_epoch, 1, __ATOMIC_RELEASE);
+    } else {
+        tlb_destroy(&fresh);
+    }
     pthread_mutex_unlock(&tlb_mutex);
-    return NULL;
+    pthread_mutex_unlock(&init_mutex);
+    return 0;
 }
 
 void print_TLB_missrate() {
     pthread_mutex_lock(&tlb_mutex);
+    unsigned long long tlb_hits = 0, tlb_misses = 0, l1_hits = 0, large_hits = 0;
+    for (int i = 0; i < TLB_STAT_STRIPES; i++) {
+        tlb_hits += __atomic_load_n(&tlb_stats[i].hits, __ATOMIC_RELAXED);
+        tlb_misses += __atomic_load_n(&tlb_stats[i].misses, __ATOMIC_RELAXED);
+        l1_hits += __atomic_load_n(&tlb_stats[i].l1_hits, __ATOMIC_RELAXED);
+        large_hits += __atomic_load_n(&tlb_stats[i].large_hits, __ATOMIC_RELAXED);
+    }
     double total = tlb_hits + tlb_misses;
     double miss_rate = total > 0 ? (tlb_misses / total) * 100.0 : 0.0;
+    fprintf(stderr, "TLB: %u entries, %u-way, %s replacement\n",
+            tlb_entries, tlb_ways, tlb_policy_name(tlb_policy));
     fprintf(stderr, "Number of TLB Misses: %lld\n", tlb_misses);
     fprintf(stderr, "Number of TLB Hits: %lld\n", tlb_hits);
+    fprintf(stderr, "  of which per-thread L1 hits: %lld\n", l1_hits);
+    fprintf(stderr, "  of which superpage TLB hits: %lld\n", large_hits);
     fprintf(stderr, "TLB miss rate: %lf%%\n", miss_rate);
     pthread_mutex_unlock(&tlb_mutex);
+}
+
+void print_fault_stats() {
+    fprintf(stderr, "Demand paging: %s\n", demand_paging ? "on" : "off");
+    fprintf(stderr, "Demand-zero faults: %lld\n", __atomic_load_n(&demand_faults, __ATOMIC_RELAXED));
+    fprintf(stderr, "Major faults: %lld\n", __atomic_load_n(&major_faults, __ATOMIC_RELAXED));
+    fprintf(stderr, "Copy-on-write faults: %lld\n", __atomic_load_n(&cow_faults, __ATOMIC_RELAXED));
+    if (swap_enabled) {
+        fprintf(stderr, "Swap: %lu of %lu slots in use, %lld pages read, %lld pages written\n",
+                swap_store.nslots - swap_store.free_slots, swap_store.nslots,
+                __atomic_load_n(&swap_store.reads, __ATOMIC_RELAXED),
+                __atomic_load_n(&swap_store.writes, __ATOMIC_RELAXED));
+    }
 }
\ No newline at end of file
@@ -4,6 +4,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tlb.h"
+#include "buddy.h"
+#include "extent.h"
+#include "bitmap.h"
+#include "gemm.h"
+#include "slab.h"
+#include "swap.h"
 
 //Assume the address space is 32 bits, so the max memory size is 4GB
 //Page size is 4KB
@@ -22,6 +35,30 @@
 typedef unsigned long pte_t;
 typedef unsigned long pde_t;
 
+// Software-defined bit of a non-present PTE: the page belongs to a
+// demand-paged allocation and gets a frame on first touch
+#define PTE_RESERVED 0x200
+// Non-present: the page is in swap, at the slot held in the frame field
+#define PTE_SWAPPED 0x400
+// Non-present: the page is being swapped out or in; walks wait for it
+#define PTE_LOCKED 0x800
+// Set by a table walk, cleared by the swap CLOCK sweep
+#define PTE_ACCESSED 0x20
+// Clear in both mappings of a page shared by n_fork, until one writes
+#define PTE_WRITE 0x2
+
+// Directory entry that maps a 4 MB superpage directly (x86 PS bit)
+#define PDE_LARGE 0x80
+#define LARGE_PAGE_ORDER 10
+#define LARGE_PAGE_FRAMES (1UL << LARGE_PAGE_ORDER)
+#define LARGE_PAGE_SIZE (LARGE_PAGE_FRAMES * PAGE_SIZE)
+
+// Address spaces that can be live at once, the default one included. Each
+// has its own page directory and virtual addresses over the shared frames.
+// One short of 4096, so that no (ASID, page) owner tag of a frame can equal
+// the all-ones tag of a shared frame, even with 32-bit longs.
+#define VM_MAX_SPACES 4095
+
 // Bit manipulation 
 #define SET_BIT(bitmap, index) (bitmap[(index)/8] |= (1 << ((index)%8)))
 #define CLEAR_BIT(bitmap, index) (bitmap[(index)/8] &= ~(1 << ((index)%8)))
@@ -39,29 +76,37 @@ extern unsigned long PAGE_TABLE_MASK;
 #define TOTAL_PHYSICAL_PAGES (MEMSIZE/PAGE_SIZE)
 
 
-#define TLB_ENTRIES 512
-
-struct tlb {
-    unsigned long *vpn;     
-    unsigned long *ppn;     
-    unsigned char *valid;   
-};
 extern struct tlb tlb_store;
+extern struct tlb tlb_large;
 
 
 extern void *physical_memory;
 extern unsigned char *physical_bitmap;
+extern struct buddy frame_pool;
 extern unsigned char *virtual_bitmap;
+extern struct extent_map va_space;
+extern struct slab_allocator slab_pool;
+extern struct swap_area swap_store;
 extern pde_t *page_directory;
 extern pthread_mutex_t tlb_mutex;
 extern pthread_mutex_t virtual_mem_mutex;
 extern pthread_mutex_t init_mutex;
 
 
-#define GET_PAGE_DIR_INDEX(va) ((unsigned long)va >> (PAGE_TABLE_BITS + OFFSET_BITS))
-#define GET_PAGE_TABLE_INDEX(va) (((unsigned long)va >> OFFSET_BITS) & PAGE_TABLE_MASK)
-#define GET_OFFSET(va) ((unsigned long)va & OFFSET_MASK)
-#define GET_VPN(va) ((unsigned long)va >> OFFSET_BITS)
+#define GET_PAGE_DIR_INDEX(va) ((unsigned long)(va) >> (PAGE_TABLE_BITS + OFFSET_BITS))
+#define GET_PAGE_TABLE_INDEX(va) (((unsigned long)(va) >> OFFSET_BITS) & PAGE_TABLE_MASK)
+#define GET_OFFSET(va) ((unsigned long)(va) & OFFSET_MASK)
+#define GET_VPN(va) ((unsigned long)(va) >> OFFSET_BITS)
+
+
+struct vm_space;
+
+// One element of a put_data_v / get_data_v batch
+struct vm_iov {
+    void *va;
+    void *buf;
+    unsigned int len;
+};
 
 
 int set_page_size(int page_size_kb);
@@ -71,11 +116,35 @@ int map_page(pde_t *pgdir, void *va, void* pa);
 void *get_next_avail(int num_pages);
 void *n_malloc(unsigned int num_bytes);
 void n_free(void *va, int size);
+void *n_fork(void *va, unsigned int num_bytes);
 int put_data(void *va, void *val, int size);
 void get_data(void *va, void *val, int size);
+int put_data_v(struct vm_iov *iov, int count);
+int get_data_v(struct vm_iov *iov, int count);
+int n_pin(void *va, unsigned int len, struct iovec *out, int max);
+int n_pin_read(void *va, unsigned int len, struct iovec *out, int max);
+void n_unpin(struct iovec *iov, int count);
+int n_memcpy(void *dst_va, void *src_va, unsigned int len);
+int n_memmove(void *dst_va, void *src_va, unsigned int len);
+int n_memset(void *va, int c, unsigned int len);
 void mat_mult(void *mat1, void *mat2, int size, void *answer);
+void mat_mult_parallel(void *mat1, void *mat2, int size, void *answer, int nthreads);
 int TLB_add(void *va, void *pa);
 pte_t *TLB_check(void *va);
+void TLB_invalidate_range(void *va, unsigned long npages);
+int TLB_configure(unsigned int entries, unsigned int ways, int policy);
 void print_TLB_missrate();
+void set_demand_paging(int enabled);
+void set_superpage_threshold(unsigned int num_bytes);
+int set_swap(const char *path, unsigned long num_pages);
+void print_fault_stats();
+struct vm_space *vm_space_create();
+int vm_space_destroy(struct vm_space *space);
+struct vm_space *vm_space_switch(struct vm_space *space);
+struct vm_space *vm_space_current();
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,363 @@
+#ifndef MY_VM_HPP_INCLUDED
+#define MY_VM_HPP_INCLUDED
+
+// C++ matrix kernels over VM memory for any arithmetic element type.
+// vm::gemm<T> and vm::gemv<T> work on row-major size x size matrices
+// allocated with n_malloc. Like mat_mult they build the output a tile at
+// a time in a small host buffer, moving row segments with get_data /
+// put_data. Each T gets its own instantiation of the register-blocked
+// inner loop, sized to one 256-bit vector of T so the compiler can
+// vectorize it. gemm<int32_t> is mat_mult itself.
+//
+// vm::ptr<T> is a typed virtual address whose elements are read and
+// written through get_data / put_data. vm::span<T> pins a range once and
+// keeps the host pointer of each of its pages; operator[] and its
+// random-access iterators index that table instead of translating, so
+// standard algorithms run over VM memory without a copy per element.
+//
+// Works over whichever engine header was included first, my_vm.h by
+// default.
+
+#ifndef MY_VM64_H_INCLUDED
+#include "my_vm.h"
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace vm {
+
+namespace detail {
+
+// Tiles keep the byte sizes of the int kernel in gemm.h
+template <typename T> struct tile {
+    static constexpr int i = GEMM_TILE_I;
+    static constexpr int j = GEMM_TILE_J * (int)sizeof(int) / (int)sizeof(T);
+    static constexpr int k = GEMM_TILE_K;
+    static constexpr int width = 32 / (int)sizeof(T);   // One 256-bit vector
+};
+
+// C += A * B on host memory, 4 x 2 vectors of C held across the k loop
+template <typename T>
+inline void kernel(int m, int n, int k, const T *a, int lda, const T *b, int ldb, T *c, int ldc) {
+    constexpr int W = 2 * tile<T>::width;
+    int i = 0;
+    for (; i + 4 <= m; i += 4) {
+        int j = 0;
+        for (; j + W <= n; j += W) {
+            T acc[4][W];
+            for (int r = 0; r < 4; r++) {
+                for (int x = 0; x < W; x++) acc[r][x] = c[(i + r) * ldc + j + x];
+            }
+            for (int p = 0; p < k; p++) {
+                const T *brow = b + p * ldb + j;
+                for (int r = 0; r < 4; r++) {
+                    T av = a[(i + r) * lda + p];
+                    for (int x = 0; x < W; x++) acc[r][x] += av * brow[x];
+                }
+            }
+            for (int r = 0; r < 4; r++) {
+                for (int x = 0; x < W; x++) c[(i + r) * ldc + j + x] = acc[r][x];
+            }
+        }
+        for (int r = 0; r < 4; r++) {
+            for (int p = 0; p < k; p++) {
+                T av = a[(i + r) * lda + p];
+                for (int x = j; x < n; x++) c[(i + r) * ldc + x] += av * b[p * ldb + x];
+            }
+        }
+    }
+    for (; i < m; i++) {
+        for (int p = 0; p < k; p++) {
+            T av = a[i * lda + p];
+            for (int x = 0; x < n; x++) c[i * ldc + x] += av * b[p * ldb + x];
+        }
+    }
+}
+
+template <typename T>
+inline void *elem_va(void *mat, int size, int row, int col) {
+    return (char *)mat + ((unsigned long)row * size + col) * sizeof(T);
+}
+
+template <typename T>
+inline void load_tile(void *mat, int size, int row, int col, int rows, int cols, T *buf, int ld) {
+    for (int r = 0; r < rows; r++) {
+        get_data(elem_va<T>(mat, size, row + r, col), buf + r * ld, cols * sizeof(T));
+    }
+}
+
+} // namespace detail
+
+// answer = mat1 * mat2 for size x size matrices of T. Returns 0, or -1 if
+// scratch could not be allocated or a store failed.
+template <typename T>
+int gemm(void *mat1, void *mat2, int size, void *answer) {
+    static_assert(std::is_arithmetic<T>::value, "vm::gemm needs an arithmetic element type");
+    typedef detail::tile<T> t;
+    if (size <= 0) return 0;
+
+    std::vector<T> scratch(t::i * t::k + t::k * t::j + t::i * t::j);
+    T *at = scratch.data();
+    T *bt = at + t::i * t::k;
+    T *ct = bt + t::k * t::j;
+
+    for (int i0 = 0; i0 < size; i0 += t::i) {
+        int mi = size - i0 < t::i ? size - i0 : t::i;
+        for (int j0 = 0; j0 < size; j0 += t::j) {
+            int nj = size - j0 < t::j ? size - j0 : t::j;
+            memset(ct, 0, t::i * t::j * sizeof(T));
+
+            for (int k0 = 0; k0 < size; k0 += t::k) {
+                int nk = size - k0 < t::k ? size - k0 : t::k;
+                detail::load_tile(mat1, size, i0, k0, mi, nk, at, t::k);
+                detail::load_tile(mat2, size, k0, j0, nk, nj, bt, t::j);
+                detail::kernel(mi, nj, nk, at, t::k, bt, t::j, ct, t::j);
+            }
+
+            for (int r = 0; r < mi; r++) {
+                if (put_data(detail::elem_va<T>(answer, size, i0 + r, j0), ct + r * t::j,
+                             nj * sizeof(T)) != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The int kernel is mat_mult's
+template <>
+inline int gemm<int32_t>(void *mat1, void *mat2, int size, void *answer) {
+    mat_mult(mat1, mat2, size, answer);
+    return 0;
+}
+
+// y = mat * x for a size x size matrix and size-element vectors of T.
+// Rows are streamed through a tile-sized buffer; x is read once.
+template <typename T>
+int gemv(void *mat, void *x, int size, void *y) {
+    static_assert(std::is_arithmetic<T>::value, "vm::gemv needs an arithmetic element type");
+    typedef detail::tile<T> t;
+    if (size <= 0) return 0;
+
+    std::vector<T> xs(size);
+    std::vector<T> row(t::j);
+    std::vector<T> ys(t::i);
+    get_data(x, xs.data(), size * sizeof(T));
+
+    for (int i0 = 0; i0 < size; i0 += t::i) {
+        int mi = size - i0 < t::i ? size - i0 : t::i;
+        for (int r = 0; r < mi; r++) {
+            T sum = T();
+            for (int k0 = 0; k0 < size; k0 += t::j) {
+                int nk = size - k0 < t::j ? size - k0 : t::j;
+                get_data(detail::elem_va<T>(mat, size, i0 + r, k0), row.data(), nk * sizeof(T));
+                for (int p = 0; p < nk; p++) sum += row[p] * xs[k0 + p];
+            }
+            ys[r] = sum;
+        }
+        if (put_data((char *)y + (unsigned long)i0 * sizeof(T), ys.data(), mi * sizeof(T)) != 0) return -1;
+    }
+    return 0;
+}
+
+// Element reference through put_data / get_data, what ptr<T> yields
+template <typename T>
+class ref {
+public:
+    explicit ref(void *va) : va_(va) {}
+
+    operator T() const {
+        T v;
+        get_data(va_, &v, sizeof(T));
+        return v;
+    }
+    ref &operator=(const T &v) {
+        put_data(va_, (void *)&v, sizeof(T));
+        return *this;
+    }
+    ref &operator=(const ref &o) { return *this = (T)o; }
+
+private:
+    void *va_;
+};
+
+// Typed virtual address: pointer arithmetic in elements of T, every
+// access a copy through the engine
+template <typename T>
+class ptr {
+public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef ptrdiff_t difference_type;
+    typedef ptr pointer;
+    typedef vm::ref<T> reference;
+
+    ptr() : va_(0) {}
+    explicit ptr(void *va) : va_((unsigned long)va) {}
+
+    void *get() const { return (void *)va_; }
+    explicit operator bool() const { return va_ != 0; }
+
+    reference operator*() const { return reference(get()); }
+    reference operator[](ptrdiff_t i) const { return *(*this + i); }
+
+    ptr &operator+=(ptrdiff_t n) { va_ += n * (ptrdiff_t)sizeof(T); return *this; }
+    ptr &operator-=(ptrdiff_t n) { va_ -= n * (ptrdiff_t)sizeof(T); return *this; }
+    ptr &operator++() { return *this += 1; }
+    ptr &operator--() { return *this -= 1; }
+    ptr operator++(int) { ptr p = *this; ++*this; return p; }
+    ptr operator--(int) { ptr p = *this; --*this; return p; }
+    ptr operator+(ptrdiff_t n) const { ptr p = *this; return p += n; }
+    ptr operator-(ptrdiff_t n) const { ptr p = *this; return p -= n; }
+    ptrdiff_t operator-(const ptr &o) const { return ((ptrdiff_t)va_ - (ptrdiff_t)o.va_) / (ptrdiff_t)sizeof(T); }
+
+    bool operator==(const ptr &o) const { return va_ == o.va_; }
+    bool operator!=(const ptr &o) const { return va_ != o.va_; }
+    bool operator<(const ptr &o) const { return va_ < o.va_; }
+    bool operator>(const ptr &o) const { return va_ > o.va_; }
+    bool operator<=(const ptr &o) const { return va_ <= o.va_; }
+    bool operator>=(const ptr &o) const { return va_ >= o.va_; }
+
+private:
+    unsigned long va_;
+};
+
+namespace detail {
+
+#ifdef MY_VM64_H_INCLUDED
+// The 48-bit engine never moves a mapped page, so a translation holds
+// until the page is freed, and there is no sharing to break for a write
+inline int pin(void *va, size_t len, std::vector<struct iovec> &iov, bool) {
+    unsigned long addr = (unsigned long)va;
+    unsigned long end = addr + len;
+    while (addr < end) {
+        char *pa = (char *)translate(page_directory, (void *)addr);
+        if (!pa) return -1;
+        size_t chunk = PGSIZE - (addr % PGSIZE);
+        if (chunk > end - addr) chunk = end - addr;
+        iov.push_back(iovec{ pa, chunk });
+        addr += chunk;
+    }
+    return 0;
+}
+
+inline void unpin(std::vector<struct iovec> &) {}
+#else
+// A read pin leaves pages shared by n_fork shared
+inline int pin(void *va, size_t len, std::vector<struct iovec> &iov, bool write) {
+    iov.resize(len / PGSIZE + 2);
+    int n = (write ? n_pin : n_pin_read)(va, (unsigned int)len, iov.data(), (int)iov.size());
+    iov.resize(n < 0 ? 0 : n);
+    return n < 0 ? -1 : 0;
+}
+
+inline void unpin(std::vector<struct iovec> &iov) {
+    n_unpin(iov.data(), (int)iov.size());
+}
+#endif
+
+} // namespace detail
+
+// Pinned view of count elements of T at a virtual address. The frames
+// behind it stay put for the span's lifetime, so references into it stay
+// valid until it is destroyed. Elements must not straddle a page, i.e.
+// the address must be a multiple of sizeof(T). A span that could not be
+// pinned (unmapped range, bad alignment) is empty and tests false.
+// span<const T> pins for reading only, so it doesn't break copy-on-write
+// sharing of an n_fork'd range.
+template <typename T>
+class span {
+    static_assert(PGSIZE % sizeof(T) == 0, "vm::span elements must tile a page");
+
+public:
+    class iterator {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef typename std::remove_const<T>::type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T *pointer;
+        typedef T &reference;
+
+        iterator() : pages_(NULL), off_(0) {}
+        iterator(char *const *pages, unsigned long off) : pages_(pages), off_(off) {}
+
+        T &operator*() const { return *(T *)(pages_[off_ / PGSIZE] + (off_ % PGSIZE)); }
+        T *operator->() const { return &**this; }
+        T &operator[](ptrdiff_t i) const { return *(*this + i); }
+
+        iterator &operator+=(ptrdiff_t n) { off_ += n * (ptrdiff_t)sizeof(T); return *this; }
+        iterator &operator-=(ptrdiff_t n) { off_ -= n * (ptrdiff_t)sizeof(T); return *this; }
+        iterator &operator++() { off_ += sizeof(T); return *this; }
+        iterator &operator--() { off_ -= sizeof(T); return *this; }
+        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+        iterator operator--(int) { iterator it = *this; --*this; return it; }
+        iterator operator+(ptrdiff_t n) const { iterator it = *this; return it += n; }
+        iterator operator-(ptrdiff_t n) const { iterator it = *this; return it -= n; }
+        friend iterator operator+(ptrdiff_t n, const iterator &it) { return it + n; }
+        ptrdiff_t operator-(const iterator &o) const {
+            return ((ptrdiff_t)off_ - (ptrdiff_t)o.off_) / (ptrdiff_t)sizeof(T);
+        }
+
+        bool operator==(const iterator &o) const { return off_ == o.off_; }
+        bool operator!=(const iterator &o) const { return off_ != o.off_; }
+        bool operator<(const iterator &o) const { return off_ < o.off_; }
+        bool operator>(const iterator &o) const { return off_ > o.off_; }
+        bool operator<=(const iterator &o) const { return off_ <= o.off_; }
+        bool operator>=(const iterator &o) const { return off_ >= o.off_; }
+
+    private:
+        char *const *pages_;
+        unsigned long off_;                 // Bytes from the first page's start
+    };
+
+    span() : off_(0), count_(0) {}
+
+    span(ptr<T> p, size_t count) : off_(0), count_(0) {
+        unsigned long va = (unsigned long)p.get();
+        if (!va || count == 0 || va % sizeof(T) != 0) return;
+        if (detail::pin(p.get(), count * sizeof(T), iov_, !std::is_const<T>::value) != 0) return;
+
+        // One host pointer per virtual page, from the merged pin entries
+        for (size_t i = 0; i < iov_.size(); i++) {
+            char *base = (char *)iov_[i].iov_base;
+            char *end = base + iov_[i].iov_len;
+            if (pages_.empty()) base -= va % PGSIZE;
+            for (; base < end; base += PGSIZE) pages_.push_back(base);
+        }
+        off_ = va % PGSIZE;
+        count_ = count;
+    }
+
+    span(void *va, size_t count) : span(ptr<T>(va), count) {}
+
+    ~span() { detail::unpin(iov_); }
+
+    span(const span &) = delete;
+    span &operator=(const span &) = delete;
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    explicit operator bool() const { return count_ != 0; }
+
+    T &operator[](size_t i) const {
+        unsigned long b = off_ + i * sizeof(T);
+        return *(T *)(pages_[b / PGSIZE] + (b % PGSIZE));
+    }
+
+    iterator begin() const { return iterator(pages_.data(), off_); }
+    iterator end() const { return iterator(pages_.data(), off_ + count_ * sizeof(T)); }
+
+private:
+    std::vector<struct iovec> iov_;
+    std::vector<char *> pages_;
+    unsigned long off_;
+    size_t count_;
+};
+
+} // namespace vm
+
+#endif
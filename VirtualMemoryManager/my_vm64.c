@@ -1,137 +1,125 @@
-#include "my_vm.h"
+#include "my_vm64.h"
 #include <sys/mman.h>
 #include <string.h>
-#include <math.h>
 
 // Initialize global variables
 void *physical_memory = NULL;
-unsigned char *physical_bitmap = NULL;
-unsigned char *virtual_bitmap = NULL;
+unsigned char *physical_bitmap = NULL;   // Debug view of frame_pool
+unsigned char *frame_touched = NULL;     // Frames handed out at least once
+unsigned short *table_used = NULL;       // Live entries in each page-table frame
+struct buddy frame_pool;
+struct extent_map va_space;
 pde_t *page_directory = NULL;
-struct tlb tlb_store = {NULL, NULL, NULL};
+struct tlb tlb_store;
 pthread_mutex_t tlb_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t virtual_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 unsigned long long tlb_hits = 0;
 unsigned long long tlb_misses = 0;
+unsigned long long pwc_hits = 0;
+unsigned long long pwc_misses = 0;
 int memory_initialized = 0;
 
-// Dynamic page size variables
-unsigned long PGSIZE = BASE_PGSIZE;
-unsigned int OFFSET_BITS = 12;
-unsigned int PAGE_TABLE_BITS = 10;
-unsigned int PAGE_DIR_BITS = 10;
-unsigned long OFFSET_MASK = 0xFFF;
-unsigned long PAGE_TABLE_MASK = 0x3FF;
-unsigned long PAGE_DIR_MASK = 0x3FF;
-
-int initialize_page_size(unsigned long page_size) {
-    if (memory_initialized) {
-        fprintf(stderr, "Cannot change page size after memory initialization\n");
-        return -1;
-    }
-    
-    if (page_size < BASE_PGSIZE || (page_size & (page_size - 1)) != 0) {
-        fprintf(stderr, "Page size must be a power of 2 and at least 4KB\n");
-        return -1;
-    }
-
-    PGSIZE = page_size;
-    OFFSET_BITS = (unsigned int)log2(page_size);
-    
-    // Split remaining bits between directory and table
-    unsigned int remaining_bits = 32 - OFFSET_BITS;
-    PAGE_TABLE_BITS = remaining_bits / 2;
-    PAGE_DIR_BITS = remaining_bits - PAGE_TABLE_BITS;
-    
-    // Update masks
-    OFFSET_MASK = page_size - 1;
-    PAGE_TABLE_MASK = (1UL << PAGE_TABLE_BITS) - 1;
-    PAGE_DIR_MASK = (1UL << PAGE_DIR_BITS) - 1;
-    
-    return 0;
-}
-
-// Helper functions for address translation
-unsigned long get_page_dir_index(void* va) {
-    return ((unsigned long)va >> (PAGE_TABLE_BITS + OFFSET_BITS)) & PAGE_DIR_MASK;
-}
-
-unsigned long get_page_table_index(void* va) {
-    return ((unsigned long)va >> OFFSET_BITS) & PAGE_TABLE_MASK;
-}
-
-unsigned long get_page_offset(void* va) {
-    return (unsigned long)va & OFFSET_MASK;
-}
-
-unsigned long get_vpn(void* va) {
-    return (unsigned long)va >> OFFSET_BITS;
-}
+// Page-walk cache: direct-mapped, from the upper VA bits (va >> 21) to the
+// leaf table covering them, so a TLB miss costs one load instead of three
+// before the leaf. Each slot packs tag, table frame and the generation it
+// was filled in into one word. Freeing a leaf table bumps pwc_gen, which
+// retires every slot at once; tables are only freed when a whole 2 MB
+// region empties, so this is rare.
+#define PWC_GEN_BITS 17
+#define PWC_FRAME_BITS 20
+#define PWC_GEN_MASK ((1UL << PWC_GEN_BITS) - 1)
+#define PWC_FRAME_MASK ((1UL << PWC_FRAME_BITS) - 1)
+#define PWC_TAG_SHIFT (PWC_GEN_BITS + PWC_FRAME_BITS)
+unsigned long pwc[PWC_ENTRIES];
+unsigned long pwc_gen = 1;
+
+// Page tables are allocated on first use and freed when their last entry
+// goes, so only the touched parts of the 48-bit space cost frames. Table
+// changes happen under virtual_mem_mutex; walks for translation are
+// lock-free, which is safe because a table is only freed once no mapped
+// page goes through it.
+
+#define ENTRY_ADDR(e) ((e) & ~OFFSET_MASK)
+#define ENTRY_FRAME(e) (ENTRY_ADDR(e) >> OFFSET_BITS)
 
 void cleanup_physical_mem() {
     if (physical_memory) {
-        free(physical_memory);
+        munmap(physical_memory, MEMSIZE);
         physical_memory = NULL;
     }
     if (physical_bitmap) {
         free(physical_bitmap);
         physical_bitmap = NULL;
     }
-    if (virtual_bitmap) {
-        free(virtual_bitmap);
-        virtual_bitmap = NULL;
+    if (frame_touched) {
+        free(frame_touched);
+        frame_touched = NULL;
     }
-    if (tlb_store.vpn) free(tlb_store.vpn);
-    if (tlb_store.ppn) free(tlb_store.ppn);
-    if (tlb_store.valid) free(tlb_store.valid);
-    tlb_store.vpn = NULL;
-    tlb_store.ppn = NULL;
-    tlb_store.valid = NULL;
+    if (table_used) {
+        free(table_used);
+        table_used = NULL;
+    }
+    tlb_destroy(&tlb_store);
+    buddy_destroy(&frame_pool);
+    extent_destroy(&va_space);
 }
 
 void set_physical_mem() {
     pthread_mutex_lock(&init_mutex);
-    
+
     if (memory_initialized) {
         pthread_mutex_unlock(&init_mutex);
         return;
     }
 
-    physical_memory = malloc(MEMSIZE);
-    if (!physical_memory) {
+    // Reserve the arena without committing it; frames are populated when
+    // first touched and zeroed at allocation, not up front
+    physical_memory = mmap(NULL, MEMSIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (physical_memory == MAP_FAILED) {
+        physical_memory = NULL;
         perror("Physical memory allocation failed");
         pthread_mutex_unlock(&init_mutex);
         exit(1);
     }
-    memset(physical_memory, 0, MEMSIZE);
 
-    size_t physical_bitmap_size = (TOTAL_PHYSICAL_PAGES + 7) / 8;
-    size_t virtual_bitmap_size = (TOTAL_VIRTUAL_PAGES + 7) / 8;
+    // Nothing here is sized by the virtual address space
+    physical_bitmap = bitmap_alloc(TOTAL_PHYSICAL_PAGES);
+    frame_touched = bitmap_alloc(TOTAL_PHYSICAL_PAGES);
+    table_used = calloc(TOTAL_PHYSICAL_PAGES, sizeof(unsigned short));
 
-    physical_bitmap = malloc(physical_bitmap_size);
-    virtual_bitmap = malloc(virtual_bitmap_size);
-    
-    if (!physical_bitmap || !virtual_bitmap) {
+    if (!physical_bitmap || !frame_touched || !table_used) {
         perror("Bitmap allocation failed");
         cleanup_physical_mem();
         pthread_mutex_unlock(&init_mutex);
         exit(1);
     }
 
-    memset(physical_bitmap, 0, physical_bitmap_size);
-    memset(virtual_bitmap, 0, virtual_bitmap_size);
-
+    // The level-4 table lives in frame 0
     page_directory = (pde_t *)physical_memory;
     memset(page_directory, 0, PAGE_SIZE);
     SET_BIT(physical_bitmap, 0);
+    SET_BIT(frame_touched, 0);
 
-    tlb_store.vpn = (unsigned long *)calloc(TLB_ENTRIES, sizeof(unsigned long));
-    tlb_store.ppn = (unsigned long *)calloc(TLB_ENTRIES, sizeof(unsigned long));
-    tlb_store.valid = (unsigned char *)calloc(TLB_ENTRIES, sizeof(unsigned char));
-    
-    if (!tlb_store.vpn || !tlb_store.ppn || !tlb_store.valid) {
+    if (buddy_init(&frame_pool, TOTAL_PHYSICAL_PAGES) != 0) {
+        perror("Frame allocator initialization failed");
+        cleanup_physical_mem();
+        pthread_mutex_unlock(&init_mutex);
+        exit(1);
+    }
+    buddy_free_pages(&frame_pool, 1, TOTAL_PHYSICAL_PAGES - 1);
+
+    // Virtual page 0 stays unmapped so NULL is never handed out
+    if (extent_init(&va_space, 1, TOTAL_VIRTUAL_PAGES - 1) != 0) {
+        perror("Virtual address space initialization failed");
+        cleanup_physical_mem();
+        pthread_mutex_unlock(&init_mutex);
+        exit(1);
+    }
+
+    if (tlb_init(&tlb_store, TLB_ENTRIES, TLB_WAYS, TLB_POLICY_LRU) != 0) {
         perror("TLB allocation failed");
         cleanup_physical_mem();
         pthread_mutex_unlock(&init_mutex);
@@ -142,36 +130,150 @@ void set_physical_mem() {
     pthread_mutex_unlock(&init_mutex);
 }
 
+// One zeroed frame; caller holds virtual_mem_mutex. Frames that were never
+// handed out are still zero from the mapping.
+static long frame_alloc() {
+    long frame = buddy_alloc(&frame_pool, 0);
+    if (frame < 0) return -1;
+
+    SET_BIT(physical_bitmap, frame);
+    if (GET_BIT(frame_touched, frame)) {
+        memset(physical_memory + (frame * PAGE_SIZE), 0, PAGE_SIZE);
+    } else {
+        SET_BIT(frame_touched, frame);
+    }
+    return frame;
+}
+
+// Caller holds virtual_mem_mutex
+static void frame_release(unsigned long frame) {
+    CLEAR_BIT(physical_bitmap, frame);
+    buddy_free(&frame_pool, frame, 0);
+}
+
+// Walk from the level-4 table down to va's leaf (level-1) table. With
+// create set, missing tables are allocated on the way (caller holds
+// virtual_mem_mutex); otherwise NULL when one is missing.
+static pte_t *walk_table(pde_t *pgdir, void *va, int create) {
+    pde_t *table = pgdir;
+
+    for (int level = PAGE_LEVELS - 1; level > 0; level--) {
+        pde_t *entry = &table[GET_LEVEL_INDEX(va, level)];
+        pde_t e = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+
+        if (!(e & 0x1)) {
+            if (!create) return NULL;
+            long frame = frame_alloc();
+            if (frame < 0) return NULL;
+
+            e = (frame << OFFSET_BITS) | 0x7;
+            __atomic_store_n(entry, e, __ATOMIC_RELEASE);
+            table_used[((unsigned long)table - (unsigned long)physical_memory) >> OFFSET_BITS]++;
+        }
+        table = (pde_t *)(physical_memory + ENTRY_ADDR(e));
+    }
+    return table;
+}
+
+// Leaf table for va, through the page-walk cache. The generation is read
+// before walking, so a fill that raced a table free carries the old
+// generation and never hits.
+static pte_t *leaf_table(pde_t *pgdir, void *va) {
+    unsigned long tag = (unsigned long)va >> PAGE_SHIFT(1);
+    unsigned long *slot = &pwc[tag % PWC_ENTRIES];
+    unsigned long gen = __atomic_load_n(&pwc_gen, __ATOMIC_ACQUIRE) & PWC_GEN_MASK;
+    unsigned long e = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    if ((e >> PWC_TAG_SHIFT) == tag && (e & PWC_GEN_MASK) == gen) {
+        __atomic_fetch_add(&pwc_hits, 1, __ATOMIC_RELAXED);
+        return (pte_t *)(physical_memory + (((e >> PWC_GEN_BITS) & PWC_FRAME_MASK) << OFFSET_BITS));
+    }
+    __atomic_fetch_add(&pwc_misses, 1, __ATOMIC_RELAXED);
+
+    pte_t *table = walk_table(pgdir, va, 0);
+    if (table) {
+        unsigned long frame = ((unsigned long)table - (unsigned long)physical_memory) >> OFFSET_BITS;
+        __atomic_store_n(slot, (tag << PWC_TAG_SHIFT) | (frame << PWC_GEN_BITS) | gen, __ATOMIC_RELAXED);
+    }
+    return table;
+}
+
+// A leaf table is going away: retire every cached walk. Caller holds
+// virtual_mem_mutex and has already unlinked the table.
+static void pwc_invalidate() {
+    unsigned long gen = __atomic_add_fetch(&pwc_gen, 1, __ATOMIC_SEQ_CST);
+
+    // After wrap-around, ancient slots would match again, so sweep once
+    if ((gen & PWC_GEN_MASK) == 0) {
+        for (unsigned int i = 0; i < PWC_ENTRIES; i++) __atomic_store_n(&pwc[i], 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pwc_gen, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// va's level-1 entry, or NULL when its leaf table doesn't exist
+static pte_t *walk(pde_t *pgdir, void *va) {
+    pte_t *table = leaf_table(pgdir, va);
+    return table ? &table[GET_LEVEL_INDEX(va, 0)] : NULL;
+}
+
+// Clear va's level-1 entry and free every table on the path that it
+// leaves empty. Returns the old entry (0 if nothing was mapped). Caller
+// holds virtual_mem_mutex.
+static pte_t unmap_one(void *va) {
+    pde_t *path[PAGE_LEVELS];
+    path[PAGE_LEVELS - 1] = page_directory;
+
+    for (int level = PAGE_LEVELS - 1; level > 0; level--) {
+        pde_t e = path[level][GET_LEVEL_INDEX(va, level)];
+        if (!(e & 0x1)) return 0;
+        path[level - 1] = (pde_t *)(physical_memory + ENTRY_ADDR(e));
+    }
+
+    pte_t *pt_entry = &path[0][GET_LEVEL_INDEX(va, 0)];
+    pte_t old = *pt_entry;
+    if (!(old & 0x1)) return 0;
+    __atomic_store_n(pt_entry, 0, __ATOMIC_RELEASE);
+
+    // Walk back up while tables become empty; the root always stays
+    for (int level = 0; level < PAGE_LEVELS - 1; level++) {
+        unsigned long frame = ((unsigned long)path[level] - (unsigned long)physical_memory) >> OFFSET_BITS;
+        if (--table_used[frame] > 0) break;
+
+        __atomic_store_n(&path[level + 1][GET_LEVEL_INDEX(va, level + 1)], 0, __ATOMIC_RELEASE);
+        if (level == 0) pwc_invalidate();
+        frame_release(frame);
+    }
+    return old;
+}
+
+// Lookups take no lock; fills re-check the entry after reserving a slot so
+// a racing free can't leave a stale translation behind
 int TLB_add(void *va, void *pa) {
-    pthread_mutex_lock(&tlb_mutex);
-    
-    unsigned long vpn = get_vpn(va);
+    unsigned long vpn = GET_VPN(va);
     unsigned long ppn = ((unsigned long)pa - (unsigned long)physical_memory) >> OFFSET_BITS;
-    unsigned long index = vpn % TLB_ENTRIES;
-    
-    tlb_store.vpn[index] = vpn;
-    tlb_store.ppn[index] = ppn;
-    tlb_store.valid[index] = 1;
-    
-    pthread_mutex_unlock(&tlb_mutex);
+    struct tlb_gen gen;
+    struct tlb_entry *slot = tlb_reserve(&tlb_store, 0, vpn, &gen);
+
+    pte_t *table = walk_table(page_directory, va, 0);
+    pte_t *pt_entry = table ? &table[GET_LEVEL_INDEX(va, 0)] : NULL;
+    pte_t pte = pt_entry ? __atomic_load_n(pt_entry, __ATOMIC_RELAXED) : 0;
+    if ((pte & 0x1) && ENTRY_FRAME(pte) == ppn) {
+        tlb_fill(&tlb_store, slot, 0, vpn, ppn, gen);
+    } else {
+        tlb_release(slot);
+    }
     return 0;
 }
 
 pte_t *TLB_check(void *va) {
-    pthread_mutex_lock(&tlb_mutex);
-    
-    unsigned long vpn = get_vpn(va);
-    unsigned long index = vpn % TLB_ENTRIES;
-    
-    if (tlb_store.valid[index] && tlb_store.vpn[index] == vpn) {
-        tlb_hits++;
-        void *pa = physical_memory + (tlb_store.ppn[index] << OFFSET_BITS);
-        pthread_mutex_unlock(&tlb_mutex);
-        return (pte_t *)pa;
+    unsigned long ppn;
+
+    if (tlb_lookup(&tlb_store, 0, GET_VPN(va), &ppn)) {
+        __atomic_fetch_add(&tlb_hits, 1, __ATOMIC_RELAXED);
+        return (pte_t *)(physical_memory + (ppn << OFFSET_BITS) + GET_OFFSET(va));
     }
-    
-    tlb_misses++;
-    pthread_mutex_unlock(&tlb_mutex);
+
+    __atomic_fetch_add(&tlb_misses, 1, __ATOMIC_RELAXED);
     return NULL;
 }
 
@@ -179,71 +281,63 @@ pte_t* translate(pde_t *pgdir, void *va) {
     pte_t *tlb_result = TLB_check(va);
     if (tlb_result) return tlb_result;
 
-    unsigned long dir_idx = get_page_dir_index(va);
-    unsigned long page_idx = get_page_table_index(va);
-    unsigned long offset = get_page_offset(va);
-
-    pde_t *dir_entry = &pgdir[dir_idx];
-    if (!(*dir_entry & 0x1)) return NULL;
+    pte_t *pt_entry = walk(pgdir, va);
+    if (!pt_entry) return NULL;
 
-    pte_t *page_table = (pte_t *)((*dir_entry & ~(PGSIZE-1)) + (unsigned long)physical_memory);
-    pte_t *pt_entry = &page_table[page_idx];
-    
-    if (!(*pt_entry & 0x1)) return NULL;
+    pte_t pte = __atomic_load_n(pt_entry, __ATOMIC_ACQUIRE);
+    if (!(pte & 0x1)) return NULL;
 
-    void *pa = physical_memory + (*pt_entry & ~(PGSIZE-1)) + offset;
+    void *pa = physical_memory + ENTRY_ADDR(pte) + GET_OFFSET(va);
     TLB_add(va, pa);
     return (pte_t *)pa;
 }
 
-int map_page(pde_t *pgdir, void *va, void *pa) {
-    unsigned long dir_idx = get_page_dir_index(va);
-    unsigned long page_idx = get_page_table_index(va);
-
-    pde_t *dir_entry = &pgdir[dir_idx];
-    
-    if (!(*dir_entry & 0x1)) {
-        void *new_pt = get_next_avail(1);
-        if (!new_pt) return -1;
-        
-        memset(new_pt, 0, PAGE_SIZE);
-        *dir_entry = ((unsigned long)new_pt - (unsigned long)physical_memory) | 0x7;
-    }
+// Caller holds virtual_mem_mutex
+static int map_one(pde_t *pgdir, void *va, void *pa) {
+    pte_t *table = leaf_table(pgdir, va);
+    if (!table) table = walk_table(pgdir, va, 1);
+    if (!table) return -1;
+    pte_t *pt_entry = &table[GET_LEVEL_INDEX(va, 0)];
 
-    pte_t *page_table = (pte_t *)((*dir_entry & ~(PGSIZE-1)) + (unsigned long)physical_memory);
-    pte_t *pt_entry = &page_table[page_idx];
-    
     if (*pt_entry & 0x1) return -1;
 
-    *pt_entry = ((unsigned long)pa - (unsigned long)physical_memory) | 0x7;
+    __atomic_store_n(pt_entry, ((unsigned long)pa - (unsigned long)physical_memory) | 0x7, __ATOMIC_RELEASE);
+    table_used[((unsigned long)pt_entry - (unsigned long)physical_memory) >> OFFSET_BITS]++;
     return 0;
 }
 
+int map_page(pde_t *pgdir, void *va, void *pa) {
+    pthread_mutex_lock(&virtual_mem_mutex);
+    int ret = map_one(pgdir, va, pa);
+    pthread_mutex_unlock(&virtual_mem_mutex);
+    return ret;
+}
+
+// Contiguous run of num_pages frames from the buddy allocator
 void *get_next_avail(int num_pages) {
     pthread_mutex_lock(&virtual_mem_mutex);
-    
-    for (size_t i = 1; i < TOTAL_PHYSICAL_PAGES; i++) {
-        if (!GET_BIT(physical_bitmap, i)) {
-            int found = 1;
-            for (int j = 1; j < num_pages && (i + j) < TOTAL_PHYSICAL_PAGES; j++) {
-                if (GET_BIT(physical_bitmap, i + j)) {
-                    found = 0;
-                    break;
-                }
-            }
-            
-            if (found) {
-                for (int j = 0; j < num_pages; j++) {
-                    SET_BIT(physical_bitmap, i + j);
-                }
-                pthread_mutex_unlock(&virtual_mem_mutex);
-                return physical_memory + (i * PAGE_SIZE);
-            }
-        }
+
+    long frame = buddy_alloc_pages(&frame_pool, num_pages);
+    if (frame < 0) {
+        pthread_mutex_unlock(&virtual_mem_mutex);
+        return NULL;
     }
-    
+    bitmap_set_range(physical_bitmap, frame, num_pages);
+    bitmap_set_range(frame_touched, frame, num_pages);
+
     pthread_mutex_unlock(&virtual_mem_mutex);
-    return NULL;
+
+    memset(physical_memory + (frame * PAGE_SIZE), 0, num_pages * PAGE_SIZE);
+    return physical_memory + (frame * PAGE_SIZE);
+}
+
+// Unmap num_pages pages from va and return their frames; caller holds
+// virtual_mem_mutex
+static void unmap_pages(void *va, unsigned long num_pages) {
+    for (unsigned long i = 0; i < num_pages; i++) {
+        pte_t old = unmap_one(va + (i * PAGE_SIZE));
+        if (old & 0x1) frame_release(ENTRY_FRAME(old));
+    }
 }
 
 void *n_malloc(unsigned int num_bytes) {
@@ -251,135 +345,92 @@ void *n_malloc(unsigned int num_bytes) {
         set_physical_mem();
     }
     if (num_bytes == 0) return NULL;
-    
+
     unsigned int num_pages = (num_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
-    void *va = NULL;
-    
+
     pthread_mutex_lock(&virtual_mem_mutex);
-    for (size_t i = 1; i < TOTAL_VIRTUAL_PAGES; i++) {
-        if (!GET_BIT(virtual_bitmap, i)) {
-            int found = 1;
-            for (int j = 1; j < num_pages && (i + j) < TOTAL_VIRTUAL_PAGES; j++) {
-                if (GET_BIT(virtual_bitmap, i + j)) {
-                    found = 0;
-                    i += j;
-                    break;
-                }
-            }
-            
-            if (found) {
-                for (int j = 0; j < num_pages; j++) {
-                    SET_BIT(virtual_bitmap, i + j);
-                }
-                va = (void *)(i * PAGE_SIZE);
-                break;
-            }
-        }
+
+    unsigned long vpn = extent_alloc(&va_space, num_pages);
+    if (!vpn) {
+        pthread_mutex_unlock(&virtual_mem_mutex);
+        return NULL;
     }
-    pthread_mutex_unlock(&virtual_mem_mutex);
-    
-    if (!va) return NULL;
+    void *va = (void *)(vpn * PAGE_SIZE);
 
     for (unsigned int i = 0; i < num_pages; i++) {
-        void *pa = get_next_avail(1);
-        if (!pa || map_page(page_directory, va + (i * PAGE_SIZE), pa) != 0) {
-            n_free(va, i * PAGE_SIZE);
+        long frame = frame_alloc();
+        if (frame < 0 || map_one(page_directory, va + (i * PAGE_SIZE), physical_memory + (frame * PAGE_SIZE)) != 0) {
+            if (frame >= 0) frame_release(frame);
+            unmap_pages(va, i);
+            extent_free(&va_space, vpn, num_pages);
+            pthread_mutex_unlock(&virtual_mem_mutex);
             return NULL;
         }
     }
-    
+
+    pthread_mutex_unlock(&virtual_mem_mutex);
     return va;
 }
 
 void n_free(void *va, int size) {
     if (!va || size <= 0) return;
-    
+
     // Calculate number of pages
     unsigned int num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     unsigned long start_vpn = (unsigned long)va / PAGE_SIZE;
-    
+
     pthread_mutex_lock(&virtual_mem_mutex);
-    
-    // For each page
-    for (unsigned int i = 0; i < num_pages; i++) {
-        void *current_va = (void *)((unsigned long)va + (i * PAGE_SIZE));
-        unsigned long dir_idx = get_page_dir_index(current_va);
-        unsigned long page_idx = get_page_table_index(current_va);
-        
-        // Get directory entry
-        pde_t *dir_entry = &page_directory[dir_idx];
-        if (!(*dir_entry & 0x1)) continue;  // Not present
-        
-        // Get page table
-        pte_t *page_table = (pte_t *)((*dir_entry & ~(PGSIZE-1)) + (unsigned long)physical_memory);
-        pte_t *pt_entry = &page_table[page_idx];
-        
-        if (*pt_entry & 0x1) {  // If page is present
-            // Get physical page number and clear physical bitmap
-            unsigned long ppn = (*pt_entry & ~(PGSIZE-1)) >> OFFSET_BITS;
-            CLEAR_BIT(physical_bitmap, ppn);
-            
-            // Clear page table entry
-            *pt_entry = 0;
-            
-            // Clear TLB entry if present
-            pthread_mutex_lock(&tlb_mutex);
-            unsigned long vpn = get_vpn(current_va);
-            for (int j = 0; j < TLB_ENTRIES; j++) {
-                if (tlb_store.valid[j] && tlb_store.vpn[j] == vpn) {
-                    tlb_store.valid[j] = 0;
-                }
-            }
-            pthread_mutex_unlock(&tlb_mutex);
-        }
-        
-        // Clear virtual bitmap
-        CLEAR_BIT(virtual_bitmap, start_vpn + i);
-    }
-    
+    unmap_pages(va, num_pages);
+    pthread_mutex_unlock(&virtual_mem_mutex);
+
+    // Entries are cleared first, so a racing fill re-checks and backs off
+    tlb_invalidate_range(&tlb_store, 0, start_vpn, num_pages);
+
+    pthread_mutex_lock(&virtual_mem_mutex);
+    extent_free(&va_space, start_vpn, num_pages);
     pthread_mutex_unlock(&virtual_mem_mutex);
     printf("Freed %d pages starting at virtual address %p\n", num_pages, va);
 }
 
 int put_data(void *va, void *val, int size) {
     if (!va || !val || size <= 0) return -1;
-    
-    unsigned long offset = get_page_offset(va);
+
+    unsigned long offset = GET_OFFSET(va);
     int remaining = size;
     int src_offset = 0;
-    
+
     while (remaining > 0) {
         void *curr_va = (void *)((unsigned long)va + src_offset);
         pte_t *pa = translate(page_directory, curr_va);
         if (!pa) return -1;
-        
+
         int chunk = PAGE_SIZE - offset;
         if (chunk > remaining) chunk = remaining;
-        
+
         memcpy(pa, (char *)val + src_offset, chunk);
         remaining -= chunk;
         src_offset += chunk;
         offset = 0;
     }
-    
+
     return 0;
 }
 
 void get_data(void *va, void *val, int size) {
     if (!va || !val || size <= 0) return;
-    
-    unsigned long offset = get_page_offset(va);
+
+    unsigned long offset = GET_OFFSET(va);
     int remaining = size;
     int dst_offset = 0;
-    
+
     while (remaining > 0) {
         void *curr_va = (void *)((unsigned long)va + dst_offset);
         pte_t *pa = translate(page_directory, curr_va);
         if (!pa) return;
-        
+
         int chunk = PAGE_SIZE - offset;
         if (chunk > remaining) chunk = remaining;
-        
+
         memcpy((char *)val + dst_offset, pa, chunk);
         remaining -= chunk;
         dst_offset += chunk;
@@ -387,51 +438,35 @@ void get_data(void *va, void *val, int size) {
     }
 }
 
+// Tile by tile through gemm.c, so scratch stays a few tiles in size
 void mat_mult(void *mat1, void *mat2, int size, void *answer) {
-    // Allocate temporary buffers for matrix operation
-    int *buffer1 = malloc(size * size * sizeof(int));
-    int *buffer2 = malloc(size * size * sizeof(int));
-    int *result = malloc(size * size * sizeof(int));
-    
-    if (!buffer1 || !buffer2 || !result) {
-        free(buffer1);
-        free(buffer2);
-        free(result);
-        return;
-    }
-    
-    // Get matrix data from virtual memory
-    get_data(mat1, buffer1, size * size * sizeof(int));
-    get_data(mat2, buffer2, size * size * sizeof(int));
-    
-    // Perform matrix multiplication
-    for (int i = 0; i < size; i++) {
-        for (int j = 0; j < size; j++) {
-            result[i * size + j] = 0;
-            for (int k = 0; k < size; k++) {
-                result[i * size + j] += buffer1[i * size + k] * buffer2[k * size + j];
-            }
-        }
-    }
-    
-    // Store result back in virtual memory
-    put_data(answer, result, size * size * sizeof(int));
-    
-    // Clean up
-    free(buffer1);
-    free(buffer2);
-    free(result);
+    struct gemm_vm g = { mat1, mat2, answer, size, get_data, put_data, NULL, NULL };
+    gemm_vm(&g);
+}
+
+// mat_mult with the output tiles shared out over nthreads pool workers
+// (0 or less: one per CPU)
+void mat_mult_parallel(void *mat1, void *mat2, int size, void *answer, int nthreads) {
+    struct gemm_vm g = { mat1, mat2, answer, size, get_data, put_data, NULL, NULL };
+    gemm_vm_parallel(&g, nthreads);
 }
 
 void print_TLB_missrate() {
     pthread_mutex_lock(&tlb_mutex);
-    
-    double total = tlb_hits + tlb_misses;
-    double miss_rate = total > 0 ? (tlb_misses / total) * 100.0 : 0.0;
-    
-    fprintf(stderr, "Number of TLB Misses: %lld\n", tlb_misses);
-    fprintf(stderr, "Number of TLB Hits: %lld\n", tlb_hits);
+
+    unsigned long long hits = __atomic_load_n(&tlb_hits, __ATOMIC_RELAXED);
+    unsigned long long misses = __atomic_load_n(&tlb_misses, __ATOMIC_RELAXED);
+    double total = hits + misses;
+    double miss_rate = total > 0 ? (misses / total) * 100.0 : 0.0;
+
+    fprintf(stderr, "Number of TLB Misses: %lld\n", misses);
+    fprintf(stderr, "Number of TLB Hits: %lld\n", hits);
     fprintf(stderr, "TLB miss rate: %lf%%\n", miss_rate);
-    
+
+    unsigned long long walk_hits = __atomic_load_n(&pwc_hits, __ATOMIC_RELAXED);
+    unsigned long long walks = walk_hits + __atomic_load_n(&pwc_misses, __ATOMIC_RELAXED);
+    fprintf(stderr, "Page-walk cache hit rate: %lf%% of %lld walks\n",
+            walks > 0 ? (walk_hits * 100.0) / walks : 0.0, walks);
+
     pthread_mutex_unlock(&tlb_mutex);
-}
\ No newline at end of file
+}
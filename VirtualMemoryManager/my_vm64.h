@@ -5,6 +5,16 @@
 #include <stdio.h>
 #include <pthread.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tlb.h"
+#include "buddy.h"
+#include "extent.h"
+#include "bitmap.h"
+#include "gemm.h"
+
 // 48-bit virtual address space (as used in x86_64)
 #define MAX_MEMSIZE 0x1000000000000ULL
 
@@ -33,25 +43,22 @@ typedef unsigned long pde_t;
 #define OFFSET_MASK ((1ULL << OFFSET_BITS) - 1)
 #define PAGE_TABLE_MASK ((1ULL << PAGE_TABLE_BITS) - 1)
 #define PAGE_SHIFT(level) (OFFSET_BITS + (PAGE_TABLE_BITS * (level)))
+#define ENTRIES_PER_TABLE (1UL << PAGE_TABLE_BITS)
+
+// Page-walk cache of leaf tables (each covers 2 MB of virtual space)
+#define PWC_ENTRIES 512
 
 // Calculate total pages
 #define TOTAL_VIRTUAL_PAGES (MAX_MEMSIZE/PAGE_SIZE)
 #define TOTAL_PHYSICAL_PAGES (MEMSIZE/PAGE_SIZE)
 
 
-#define TLB_ENTRIES 512
-
-struct tlb {
-    unsigned long *vpn;     
-    unsigned long *ppn;     
-    unsigned char *valid;  
-};
-
 // Global variables
 extern void *physical_memory;
 extern unsigned char *physical_bitmap;
-extern unsigned char *virtual_bitmap;
-extern pde_t *page_directory;        
+extern struct buddy frame_pool;
+extern struct extent_map va_space;
+extern pde_t *page_directory;           // Level-4 table
 extern struct tlb tlb_store;
 extern pthread_mutex_t tlb_mutex;
 extern pthread_mutex_t virtual_mem_mutex;
@@ -62,6 +69,8 @@ extern pthread_mutex_t init_mutex;
 #define GET_L3_INDEX(va) ((unsigned long)(va) >> (PAGE_SHIFT(2)) & PAGE_TABLE_MASK)
 #define GET_L2_INDEX(va) ((unsigned long)(va) >> (PAGE_SHIFT(1)) & PAGE_TABLE_MASK)
 #define GET_L1_INDEX(va) ((unsigned long)(va) >> (PAGE_SHIFT(0)) & PAGE_TABLE_MASK)
+// Index into the table at level (0 = L1 ... 3 = L4)
+#define GET_LEVEL_INDEX(va, level) ((unsigned long)(va) >> (PAGE_SHIFT(level)) & PAGE_TABLE_MASK)
 #define GET_OFFSET(va) ((unsigned long)(va) & OFFSET_MASK)
 #define GET_VPN(va) ((unsigned long)(va) >> OFFSET_BITS)
 
@@ -79,10 +88,15 @@ void n_free(void *va, int size);
 int put_data(void *va, void *val, int size);
 void get_data(void *va, void *val, int size);
 void mat_mult(void *mat1, void *mat2, int size, void *answer);
+void mat_mult_parallel(void *mat1, void *mat2, int size, void *answer, int nthreads);
 
 
 int TLB_add(void *va, void *pa);
 pte_t *TLB_check(void *va);
 void print_TLB_missrate();
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "pool.h"
+
+// Next task for worker id: its own newest, else the oldest of another's
+static int take_task(struct task_pool *p, int id, int active) {
+    struct pool_deque *d = &p->deque[id];
+    int task = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom) task = --d->bottom;
+    pthread_mutex_unlock(&d->lock);
+    if (task >= 0) return task;
+
+    for (int n = 1; n < active && task < 0; n++) {
+        struct pool_deque *v = &p->deque[(id + n) % active];
+        pthread_mutex_lock(&v->lock);
+        if (v->top < v->bottom) task = v->top++;
+        pthread_mutex_unlock(&v->lock);
+    }
+    return task;
+}
+
+static void *pool_main(void *arg) {
+    struct pool_worker *w = (struct pool_worker *)arg;
+    struct task_pool *p = w->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->job == seen) pthread_cond_wait(&p->start, &p->lock);
+        seen = p->job;
+        if (w->id >= p->active) continue;
+
+        int active = p->active;
+        void (*fn)(void *, int, int) = p->fn;
+        void *fn_arg = p->arg;
+        pthread_mutex_unlock(&p->lock);
+
+        int task;
+        while ((task = take_task(p, w->id, active)) >= 0) fn(fn_arg, task, w->id);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->running == 0) pthread_cond_signal(&p->done);
+    }
+    return NULL;
+}
+
+// Bring the pool up to n threads; returns how many it has
+static int pool_grow(struct task_pool *p, int n) {
+    if (!p->ready) {
+        for (int i = 0; i < POOL_MAX_WORKERS; i++) pthread_mutex_init(&p->deque[i].lock, NULL);
+        p->ready = 1;
+    }
+
+    while (p->nthreads < n) {
+        struct pool_worker *w = &p->worker[p->nthreads];
+        pthread_t thread;
+        w->pool = p;
+        w->id = p->nthreads;
+        if (pthread_create(&thread, NULL, pool_main, w) != 0) break;
+        pthread_detach(thread);
+        p->nthreads++;
+    }
+    return p->nthreads;
+}
+
+int pool_run(struct task_pool *p, int nworkers, int ntasks,
+             void (*fn)(void *arg, int task, int worker), void *arg) {
+    if (ntasks <= 0) return 0;
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > POOL_MAX_WORKERS) nworkers = POOL_MAX_WORKERS;
+    if (nworkers > ntasks) nworkers = ntasks;
+
+    pthread_mutex_lock(&p->run_lock);
+    pthread_mutex_lock(&p->lock);
+    if (pool_grow(p, nworkers) < nworkers) nworkers = p->nthreads;
+    if (nworkers == 0) {
+        pthread_mutex_unlock(&p->lock);
+        pthread_mutex_unlock(&p->run_lock);
+        return -1;
+    }
+
+    // Deal the tasks out in contiguous ranges, so neighbouring tasks
+    // start on the same worker
+    for (int i = 0; i < nworkers; i++) {
+        struct pool_deque *d = &p->deque[i];
+        pthread_mutex_lock(&d->lock);
+        d->top = (int)((long)ntasks * i / nworkers);
+        d->bottom = (int)((long)ntasks * (i + 1) / nworkers);
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    p->fn = fn;
+    p->arg = arg;
+    p->active = nworkers;
+    p->running = nworkers;
+    p->job++;
+    pthread_cond_broadcast(&p->start);
+    while (p->running > 0) pthread_cond_wait(&p->done, &p->lock);
+
+    pthread_mutex_unlock(&p->lock);
+    pthread_mutex_unlock(&p->run_lock);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+#include <pthread.h>
+
+// Persistent worker pool with per-worker deques and work stealing.
+// A job is ntasks independent calls fn(arg, task, worker). The task ids are
+// dealt out as one contiguous range per worker; a worker pops from the
+// bottom of its own range and, once it runs dry, steals from the top of
+// the others'. Tasks can't spawn tasks, so a worker that finds every
+// deque empty is done with the job. Threads are created on first need
+// and kept for later jobs; one job runs at a time.
+
+#define POOL_MAX_WORKERS 64
+
+struct pool_deque {
+    pthread_mutex_t lock;
+    int top;                    // Next task a thief takes
+    int bottom;                 // One past the owner's next task
+} __attribute__((aligned(64)));
+
+struct task_pool;
+
+struct pool_worker {
+    struct task_pool *pool;
+    int id;
+};
+
+struct task_pool {
+    pthread_mutex_t run_lock;   // Held for the length of a job
+    pthread_mutex_t lock;       // Guards everything below
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int ready;                  // Deque locks initialized
+    int nthreads;
+    unsigned long job;          // Bumped per job, wakes the workers
+    int active;                 // Workers taking part in the current job
+    int running;                // Of those, how many are still working
+    void (*fn)(void *arg, int task, int worker);
+    void *arg;
+    struct pool_deque deque[POOL_MAX_WORKERS];
+    struct pool_worker worker[POOL_MAX_WORKERS];
+};
+
+#define TASK_POOL_INITIALIZER { .run_lock = PTHREAD_MUTEX_INITIALIZER, .lock = PTHREAD_MUTEX_INITIALIZER, \
+                                .start = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER }
+
+// Run a job on nworkers workers (clamped to POOL_MAX_WORKERS) and wait for
+// it. Returns -1 if no worker thread could be started.
+int pool_run(struct task_pool *p, int nworkers, int ntasks,
+             void (*fn)(void *arg, int task, int worker), void *arg);
+
+#endif
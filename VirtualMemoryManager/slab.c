@@ -0,0 +1,142 @@
+#include "slab.h"
+#include "bitmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define OBJ_SHIFT(cls) (SLAB_MIN_SHIFT + (cls))
+
+static unsigned int size_class(unsigned int size) {
+    unsigned int cls = 0;
+    while ((SLAB_MIN_SIZE << cls) < size) cls++;
+    return cls;
+}
+
+static void partial_push(struct slab_allocator *a, struct slab *s) {
+    s->prev = NULL;
+    s->next = a->partial[s->cls];
+    if (s->next) s->next->prev = s;
+    a->partial[s->cls] = s;
+    s->on_partial = 1;
+}
+
+static void partial_remove(struct slab_allocator *a, struct slab *s) {
+    if (s->prev) s->prev->next = s->next;
+    else a->partial[s->cls] = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->on_partial = 0;
+}
+
+static struct slab *hash_find(struct slab_allocator *a, unsigned long vpn) {
+    struct slab *s = a->hash[vpn % SLAB_HASH_BUCKETS];
+    while (s && s->vpn != vpn) s = s->hnext;
+    return s;
+}
+
+static void hash_remove(struct slab_allocator *a, struct slab *s) {
+    struct slab **p = &a->hash[s->vpn % SLAB_HASH_BUCKETS];
+    while (*p != s) p = &(*p)->hnext;
+    *p = s->hnext;
+}
+
+void slab_init(struct slab_allocator *a, unsigned int page_size,
+               unsigned long (*get_page)(void), void (*put_page)(unsigned long)) {
+    memset(a, 0, sizeof(*a));
+    pthread_mutex_init(&a->lock, NULL);
+    a->page_size = page_size;
+    a->get_page = get_page;
+    a->put_page = put_page;
+}
+
+// Drops the headers only; the pages go away with the address space
+void slab_destroy(struct slab_allocator *a) {
+    for (int i = 0; i < SLAB_HASH_BUCKETS; i++) {
+        struct slab *s = a->hash[i];
+        while (s) {
+            struct slab *next = s->hnext;
+            free(s);
+            s = next;
+        }
+        a->hash[i] = NULL;
+    }
+    memset(a->partial, 0, sizeof(a->partial));
+    memset(a->slabs, 0, sizeof(a->slabs));
+    memset(a->objects, 0, sizeof(a->objects));
+}
+
+// Returns the object's virtual address, or 0 when the size has no class
+// or no page could be had
+unsigned long slab_alloc(struct slab_allocator *a, unsigned int size) {
+    if (size > SLAB_MAX_SIZE) return 0;
+    unsigned int cls = size_class(size);
+
+    pthread_mutex_lock(&a->lock);
+
+    struct slab *s = a->partial[cls];
+    if (!s) {
+        s = (struct slab *)calloc(1, sizeof(struct slab));
+        unsigned long vpn = s ? a->get_page() : 0;
+        if (!vpn) {
+            free(s);
+            pthread_mutex_unlock(&a->lock);
+            return 0;
+        }
+        s->vpn = vpn;
+        s->cls = cls;
+        s->objs = a->page_size >> OBJ_SHIFT(cls);
+        s->hnext = a->hash[vpn % SLAB_HASH_BUCKETS];
+        a->hash[vpn % SLAB_HASH_BUCKETS] = s;
+        partial_push(a, s);
+        a->slabs[cls]++;
+    }
+
+    unsigned long idx = bitmap_find_first_zero((unsigned char *)s->map, 0, s->objs);
+    s->map[idx / 64] |= 1ULL << (idx % 64);
+    s->used++;
+    a->objects[cls]++;
+    if (s->used == s->objs) partial_remove(a, s);
+
+    unsigned long va = s->vpn * a->page_size + (idx << OBJ_SHIFT(cls));
+    pthread_mutex_unlock(&a->lock);
+    return va;
+}
+
+// Returns -1 if va is not on a slab page. Bogus or repeated frees of slab
+// addresses are swallowed so they can't reach the page allocator.
+int slab_free(struct slab_allocator *a, unsigned long va) {
+    unsigned long vpn = va / a->page_size;
+
+    pthread_mutex_lock(&a->lock);
+
+    struct slab *s = hash_find(a, vpn);
+    if (!s) {
+        pthread_mutex_unlock(&a->lock);
+        return -1;
+    }
+
+    unsigned long off = va % a->page_size;
+    unsigned long idx = off >> OBJ_SHIFT(s->cls);
+    unsigned long long bit = 1ULL << (idx % 64);
+    if ((off & ((1UL << OBJ_SHIFT(s->cls)) - 1)) || !(s->map[idx / 64] & bit)) {
+        pthread_mutex_unlock(&a->lock);
+        return 0;
+    }
+
+    s->map[idx / 64] &= ~bit;
+    s->used--;
+    a->objects[s->cls]--;
+    if (!s->on_partial) partial_push(a, s);
+
+    // Keep one slab per class around so alloc/free pairs don't churn pages
+    if (s->used == 0 && a->slabs[s->cls] > 1) {
+        partial_remove(a, s);
+        hash_remove(a, s);
+        a->slabs[s->cls]--;
+        pthread_mutex_unlock(&a->lock);
+        a->put_page(s->vpn);
+        free(s);
+        return 0;
+    }
+
+    pthread_mutex_unlock(&a->lock);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef SLAB_H_INCLUDED
+#define SLAB_H_INCLUDED
+#include <pthread.h>
+
+// Size-class slab allocator for sub-page requests.
+// Each slab is one virtual page carved into objects of a single class
+// (16 B ... 2 KB). Slab headers live on the host heap, found through a
+// hash on the page number, so the whole page is usable for objects.
+
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 8
+#define SLAB_MIN_SIZE (1u << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE (SLAB_MIN_SIZE << (SLAB_CLASSES - 1))
+#define SLAB_HASH_BUCKETS 1024
+#define SLAB_MAX_OBJS 256           // PAGE_SIZE / SLAB_MIN_SIZE
+
+struct slab {
+    unsigned long vpn;
+    unsigned int cls;
+    unsigned int objs;
+    unsigned int used;
+    unsigned long long map[SLAB_MAX_OBJS / 64];    // Set bit = object in use
+    struct slab *prev;                              // Partial list links
+    struct slab *next;
+    struct slab *hnext;                             // Hash chain
+    int on_partial;
+};
+
+struct slab_allocator {
+    pthread_mutex_t lock;
+    unsigned int page_size;
+    struct slab *partial[SLAB_CLASSES];
+    struct slab *hash[SLAB_HASH_BUCKETS];
+    unsigned long slabs[SLAB_CLASSES];
+    unsigned long objects[SLAB_CLASSES];
+    // Page supply: return a mapped page's vpn (0 on failure) / release one
+    unsigned long (*get_page)(void);
+    void (*put_page)(unsigned long vpn);
+};
+
+void slab_init(struct slab_allocator *a, unsigned int page_size,
+               unsigned long (*get_page)(void), void (*put_page)(unsigned long));
+void slab_destroy(struct slab_allocator *a);
+unsigned long slab_alloc(struct slab_allocator *a, unsigned int size);
+int slab_free(struct slab_allocator *a, unsigned long va);
+
+#endif
@@ -0,0 +1,92 @@
+#include "swap.h"
+#include "bitmap.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Create the backing file. It is unlinked right away: swapped pages mean
+// nothing to another process, and the space goes back when we exit.
+int swap_open(struct swap_area *s, const char *path, unsigned long nslots, unsigned int slot_size) {
+    // Built without large-file offsets, the area has to stay below 2 GB
+    if (sizeof(off_t) < 8 && nslots > 0x7FFFFFFFUL / slot_size) return -1;
+
+    s->fd = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (s->fd < 0) {
+        perror("swap open failed");
+        return -1;
+    }
+    unlink(path);
+
+    s->map = bitmap_alloc(nslots);
+    if (!s->map || ftruncate(s->fd, (off_t)nslots * slot_size) != 0) {
+        perror("swap setup failed");
+        free(s->map);
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+
+    s->slot_size = slot_size;
+    s->nslots = nslots;
+    s->free_slots = nslots;
+    s->hint = 0;
+    s->reads = 0;
+    s->writes = 0;
+    pthread_mutex_init(&s->lock, NULL);
+    return 0;
+}
+
+void swap_close(struct swap_area *s) {
+    if (s->fd < 0) return;
+    close(s->fd);
+    free(s->map);
+    pthread_mutex_destroy(&s->lock);
+    s->fd = -1;
+    s->map = NULL;
+    s->nslots = 0;
+    s->free_slots = 0;
+}
+
+// Next free slot after the last one handed out, or -1 when the area is full
+long swap_alloc(struct swap_area *s) {
+    pthread_mutex_lock(&s->lock);
+    long slot = bitmap_find_first_zero(s->map, s->hint, s->nslots);
+    if (slot < 0) slot = bitmap_find_first_zero(s->map, 0, s->nslots);
+    if (slot >= 0) {
+        bitmap_set_range(s->map, slot, 1);
+        __atomic_fetch_sub(&s->free_slots, 1, __ATOMIC_RELAXED);
+        s->hint = slot + 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+void swap_free(struct swap_area *s, unsigned long slot) {
+    pthread_mutex_lock(&s->lock);
+    bitmap_clear_range(s->map, slot, 1);
+    __atomic_fetch_add(&s->free_slots, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&s->lock);
+}
+
+int swap_read(struct swap_area *s, unsigned long slot, void *buf) {
+    ssize_t n = pread(s->fd, buf, s->slot_size, (off_t)slot * s->slot_size);
+    if (n != (ssize_t)s->slot_size) {
+        if (n < 0) perror("swap read failed");
+        return -1;
+    }
+    __atomic_fetch_add(&s->reads, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int swap_write(struct swap_area *s, unsigned long slot, const void *buf) {
+    ssize_t n = pwrite(s->fd, buf, s->slot_size, (off_t)slot * s->slot_size);
+    if (n != (ssize_t)s->slot_size) {
+        if (n < 0) perror("swap write failed");
+        return -1;
+    }
+    __atomic_fetch_add(&s->writes, 1, __ATOMIC_RELAXED);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SWAP_H_INCLUDED
+#define SWAP_H_INCLUDED
+#include <pthread.h>
+
+// File-backed swap area made of page-sized slots, read and written with
+// pread / pwrite like the FUSE project's block device. The area only
+// deals in slot numbers; callers keep track of which page is where.
+
+struct swap_area {
+    int fd;
+    unsigned int slot_size;
+    unsigned long nslots;
+    unsigned long free_slots;
+    unsigned long hint;             // Where the next slot search starts
+    unsigned char *map;             // Set bit = slot in use
+    pthread_mutex_t lock;
+    unsigned long long reads;
+    unsigned long long writes;
+};
+
+int swap_open(struct swap_area *s, const char *path, unsigned long nslots, unsigned int slot_size);
+void swap_close(struct swap_area *s);
+long swap_alloc(struct swap_area *s);
+void swap_free(struct swap_area *s, unsigned long slot);
+int swap_read(struct swap_area *s, unsigned long slot, void *buf);
+int swap_write(struct swap_area *s, unsigned long slot, const void *buf);
+
+#endif
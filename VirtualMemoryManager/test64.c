@@ -0,0 +1,115 @@
+#include "my_vm64.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+// Page-walk cache counters kept by the library
+extern unsigned long long pwc_hits;
+extern unsigned long long pwc_misses;
+
+// Far apart in the 48-bit space: each needs its own L3, L2 and L1 tables
+#define FAR_VA(i) ((void *)(0x100000000000UL * (i) + 0x5000UL))
+
+void test_four_level() {
+    printf("\n=== Testing 4-Level Page Table ===\n");
+    set_physical_mem();
+
+    // The whole 48-bit space is one free extent, not a bitmap
+    assert(va_space.extents == 1);
+    assert(va_space.free_pages == TOTAL_VIRTUAL_PAGES - 1);
+
+    // Mapping a page anywhere allocates just the tables on its path
+    unsigned long before = frame_pool.free_frames;
+    void *pa[3];
+    for (int i = 0; i < 3; i++) {
+        pa[i] = get_next_avail(1);
+        assert(pa[i] != NULL);
+        assert(map_page(page_directory, FAR_VA(i + 1), pa[i]) == 0);
+        assert(map_page(page_directory, FAR_VA(i + 1), pa[i]) == -1);
+    }
+    assert(before - frame_pool.free_frames == 3 * (1 + 3));
+    for (int i = 0; i < 3; i++) {
+        assert((char *)translate(page_directory, (char *)FAR_VA(i + 1) + 123) == (char *)pa[i] + 123);
+        assert(translate(page_directory, (char *)FAR_VA(i + 1) + PGSIZE) == NULL);
+    }
+
+    // Unmapping the only page under a table frees the whole path again
+    for (int i = 0; i < 3; i++) n_free(FAR_VA(i + 1), PGSIZE);
+    assert(frame_pool.free_frames == before);
+    for (int i = 0; i < 3; i++) assert(translate(page_directory, FAR_VA(i + 1)) == NULL);
+
+    // Ordinary allocations read and write across page boundaries
+    unsigned int size = 16 * 1024 * 1024;
+    char *buf = n_malloc(size);
+    assert(buf != NULL);
+    char msg[] = "across a page boundary";
+    assert(put_data(buf + PGSIZE - 5, msg, sizeof(msg)) == 0);
+    char back[sizeof(msg)];
+    get_data(buf + PGSIZE - 5, back, sizeof(back));
+    assert(strcmp(back, msg) == 0);
+    for (unsigned int off = 0; off < size; off += PGSIZE) {
+        assert(put_data(buf + off, &off, sizeof(off)) == 0);
+    }
+    for (unsigned int off = 0; off < size; off += PGSIZE) {
+        unsigned int v = 0;
+        get_data(buf + off, &v, sizeof(v));
+        assert(v == off);
+    }
+    n_free(buf, size);
+    assert(frame_pool.free_frames == before);
+    assert(va_space.extents == 1);
+    printf("Sparse tables map, translate and free correctly\n");
+}
+
+void test_walk_cache() {
+    printf("\n=== Testing Page-Walk Cache ===\n");
+    set_physical_mem();
+
+    // Scattered accesses beyond TLB reach walk mostly through cached tables
+    unsigned int pages = 8 * TLB_ENTRIES;
+    char *buf = n_malloc(pages * PGSIZE);
+    assert(buf != NULL);
+    unsigned long long hits = pwc_hits, misses = pwc_misses;
+    for (int round = 0; round < 4; round++) {
+        for (unsigned int i = 0; i < pages; i++) {
+            unsigned int p = (i * 613) % pages;
+            assert(put_data(buf + p * PGSIZE, &p, sizeof(p)) == 0);
+        }
+    }
+    hits = pwc_hits - hits;
+    misses = pwc_misses - misses;
+    assert(hits + misses > pages);
+    assert(hits > 10 * misses);
+
+    // A freed leaf table is never reached through the cache again
+    void *far = FAR_VA(7);
+    void *pa1 = get_next_avail(1);
+    assert(map_page(page_directory, far, pa1) == 0);
+    assert((void *)translate(page_directory, far) == pa1);
+    n_free(far, PGSIZE);
+    assert(translate(page_directory, far) == NULL);
+    void *pa2 = get_next_avail(1);
+    assert(map_page(page_directory, (char *)far + PGSIZE, pa2) == 0);
+    assert((void *)translate(page_directory, (char *)far + PGSIZE) == pa2);
+    assert(translate(page_directory, far) == NULL);
+    n_free((char *)far + PGSIZE, PGSIZE);
+
+    for (unsigned int p = 0; p < pages; p++) {
+        unsigned int v = ~0u;
+        get_data(buf + p * PGSIZE, &v, sizeof(v));
+        assert(v == p);
+    }
+    n_free(buf, pages * PGSIZE);
+    print_TLB_missrate();
+    printf("Walk cache hits and invalidation correct\n");
+}
+
+int main() {
+    printf("Starting 64-bit VM tests...\n");
+
+    test_four_level();
+    test_walk_cache();
+
+    printf("\nAll 64-bit VM tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include "tlb.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Entries of set s live at [s * ways, (s + 1) * ways). Each ASID starts
+// its pages at a different set, so spaces that use the same addresses
+// don't all crowd into the same sets.
+#define ASID_SPREAD 0x9E3779B1UL
+#define SET_BASE(t, asid, vpn) ((((vpn) + (asid) * ASID_SPREAD) & ((t)->sets - 1)) * (t)->ways)
+#define AGEN(t, asid) (&(t)->agen[(asid) & (TLB_MAX_ASIDS - 1)])
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+int tlb_init(struct tlb *t, unsigned int entries, unsigned int ways, int policy) {
+    if (entries == 0 || ways == 0 || ways > entries || entries % ways != 0) return -1;
+    unsigned int sets = entries / ways;
+    if (sets & (sets - 1)) return -1;  // Set index is a mask, needs a power of 2
+    if (policy != TLB_POLICY_LRU && policy != TLB_POLICY_CLOCK) return -1;
+
+    t->entry = (struct tlb_entry *)calloc(entries, sizeof(struct tlb_entry));
+    t->hand = (unsigned int *)calloc(sets, sizeof(unsigned int));
+    t->agen = (unsigned int *)calloc(TLB_MAX_ASIDS, sizeof(unsigned int));
+
+    if (!t->entry || !t->hand || !t->agen) {
+        tlb_destroy(t);
+        return -1;
+    }
+
+    t->entries = entries;
+    t->ways = ways;
+    t->sets = sets;
+    t->tick = 0;
+    t->gen = 0;
+    t->policy = policy;
+    return 0;
+}
+
+void tlb_destroy(struct tlb *t) {
+    free(t->entry);
+    free(t->hand);
+    free(t->agen);
+    t->entry = NULL;
+    t->hand = NULL;
+    t->agen = NULL;
+}
+
+// Lock an entry for writing: readers see an odd sequence and skip it.
+// The CAS is seq_cst so it orders against a freer's PTE clear + fence.
+static void entry_lock(struct tlb_entry *e) {
+    for (;;) {
+        unsigned int seq = LOAD(&e->seq);
+        if (!(seq & 1) &&
+            __atomic_compare_exchange_n(&e->seq, &seq, seq + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return;
+        }
+        __builtin_ia32_pause();
+    }
+}
+
+static void entry_unlock(struct tlb_entry *e) {
+    __atomic_store_n(&e->seq, LOAD(&e->seq) + 1, __ATOMIC_RELEASE);
+}
+
+int tlb_lookup(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long *ppn) {
+    struct tlb_entry *e = &t->entry[SET_BASE(t, asid, vpn)];
+
+    for (unsigned int i = 0; i < t->ways; i++, e++) {
+        unsigned int seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+
+        unsigned int valid = LOAD(&e->valid);
+        unsigned int gen = LOAD(&e->gen);
+        unsigned int agen = LOAD(&e->agen);
+        unsigned int space = LOAD(&e->asid);
+        unsigned long tag = LOAD(&e->vpn);
+        unsigned long frame = LOAD(&e->ppn);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // A writer got in between: treat it as a miss and let the walk refill
+        if (LOAD(&e->seq) != seq) continue;
+        if (!valid || tag != vpn || space != asid) continue;
+        if (gen != LOAD(&t->gen) || agen != LOAD(AGEN(t, asid))) continue;
+
+        // Only dirty the line when the replacement state actually changes
+        unsigned int stamp = (t->policy == TLB_POLICY_LRU) ? LOAD(&t->tick) : 1;
+        if (LOAD(&e->stamp) != stamp) STORE(&e->stamp, stamp);
+
+        *ppn = frame;
+        return 1;
+    }
+    return 0;
+}
+
+// Pick the way to replace in the set starting at base. Replacement state
+// is only a hint, so it is read and updated without locking.
+static unsigned int tlb_victim(struct tlb *t, unsigned int base, unsigned int gen) {
+    for (unsigned int i = base; i < base + t->ways; i++) {
+        struct tlb_entry *e = &t->entry[i];
+        if (!LOAD(&e->valid) || LOAD(&e->gen) != gen || LOAD(&e->agen) != LOAD(AGEN(t, LOAD(&e->asid)))) {
+            return i;
+        }
+    }
+
+    if (t->policy == TLB_POLICY_LRU) {
+        unsigned int victim = base;
+        for (unsigned int i = base + 1; i < base + t->ways; i++) {
+            // Wrap-safe comparison of ticks
+            if ((int)(LOAD(&t->entry[i].stamp) - LOAD(&t->entry[victim].stamp)) < 0) victim = i;
+        }
+        return victim;
+    }
+
+    // CLOCK: give referenced ways a second chance
+    unsigned int *hand = &t->hand[base / t->ways];
+    for (;;) {
+        unsigned int way = __atomic_fetch_add(hand, 1, __ATOMIC_RELAXED) % t->ways;
+        unsigned int i = base + way;
+        if (!LOAD(&t->entry[i].stamp)) return i;
+        STORE(&t->entry[i].stamp, 0);
+    }
+}
+
+// Choose and lock the slot vpn will be filled into. *gen holds the
+// generations to tag it with, sampled after the lock so that a racing
+// flush either shows up here or makes the entry stale. The caller
+// validates the mapping and then calls tlb_fill() or tlb_release().
+struct tlb_entry *tlb_reserve(struct tlb *t, unsigned int asid, unsigned long vpn, struct tlb_gen *gen) {
+    unsigned int base = SET_BASE(t, asid, vpn);
+    unsigned int g = __atomic_load_n(&t->gen, __ATOMIC_ACQUIRE);
+    unsigned int ag = __atomic_load_n(AGEN(t, asid), __ATOMIC_ACQUIRE);
+    unsigned int slot = base + t->ways;
+
+    // Refresh an existing mapping instead of duplicating it
+    for (unsigned int i = base; i < base + t->ways; i++) {
+        if (LOAD(&t->entry[i].valid) && LOAD(&t->entry[i].gen) == g && LOAD(&t->entry[i].agen) == ag &&
+            LOAD(&t->entry[i].vpn) == vpn && LOAD(&t->entry[i].asid) == asid) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == base + t->ways) slot = tlb_victim(t, base, g);
+
+    struct tlb_entry *e = &t->entry[slot];
+    entry_lock(e);
+    gen->all = __atomic_load_n(&t->gen, __ATOMIC_ACQUIRE);
+    gen->space = __atomic_load_n(AGEN(t, asid), __ATOMIC_ACQUIRE);
+    return e;
+}
+
+void tlb_fill(struct tlb *t, struct tlb_entry *e, unsigned int asid, unsigned long vpn,
+              unsigned long ppn, struct tlb_gen gen) {
+    // The tick only advances on fills, so hits never write a shared counter
+    unsigned int tick = __atomic_add_fetch(&t->tick, 1, __ATOMIC_RELAXED);
+
+    STORE(&e->asid, asid);
+    STORE(&e->vpn, vpn);
+    STORE(&e->ppn, ppn);
+    STORE(&e->valid, 1);
+    STORE(&e->gen, gen.all);
+    STORE(&e->agen, gen.space);
+    STORE(&e->stamp, (t->policy == TLB_POLICY_LRU) ? tick : 1);
+    entry_unlock(e);
+}
+
+void tlb_release(struct tlb_entry *e) {
+    entry_unlock(e);
+}
+
+void tlb_insert(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long ppn) {
+    struct tlb_gen gen;
+    struct tlb_entry *e = tlb_reserve(t, asid, vpn, &gen);
+    tlb_fill(t, e, asid, vpn, ppn, gen);
+}
+
+static void invalidate_one(struct tlb *t, unsigned int asid, unsigned long vpn) {
+    unsigned int base = SET_BASE(t, asid, vpn);
+
+    for (unsigned int i = base; i < base + t->ways; i++) {
+        struct tlb_entry *e = &t->entry[i];
+
+        // Ways being filled may be about to cache vpn, so wait them out
+        if (!(LOAD(&e->seq) & 1) &&
+            (!LOAD(&e->valid) || LOAD(&e->vpn) != vpn || LOAD(&e->asid) != asid)) continue;
+
+        entry_lock(e);
+        if (e->valid && e->vpn == vpn && e->asid == asid) STORE(&e->valid, 0);
+        entry_unlock(e);
+    }
+}
+
+// Callers clear the PTE first. The fence pairs with the CAS in
+// entry_lock(): either a racing fill sees the cleared PTE or we see its
+// locked slot and wait for it.
+void tlb_invalidate(struct tlb *t, unsigned int asid, unsigned long vpn) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    invalidate_one(t, asid, vpn);
+}
+
+// Small ranges clear their own slots (O(npages * ways)). Once the range
+// would touch every set anyway, bumping the space's generation is O(1)
+// and leaves other spaces' translations cached.
+void tlb_invalidate_range(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long npages) {
+    if (npages >= t->sets) {
+        tlb_flush_asid(t, asid);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (unsigned long i = 0; i < npages; i++) {
+        invalidate_one(t, asid, vpn + i);
+    }
+}
+
+// O(1): the space's entries from older generations no longer match.
+// ASIDs that alias one generation are flushed together.
+void tlb_flush_asid(struct tlb *t, unsigned int asid) {
+    unsigned int gen = __atomic_add_fetch(AGEN(t, asid), 1, __ATOMIC_SEQ_CST);
+
+    // After wrap-around, ancient entries would match again, so sweep once
+    if (gen == 0) {
+        for (unsigned int i = 0; i < t->entries; i++) {
+            struct tlb_entry *e = &t->entry[i];
+            if (((LOAD(&e->asid) ^ asid) & (TLB_MAX_ASIDS - 1)) != 0) continue;
+            entry_lock(e);
+            STORE(&e->valid, 0);
+            entry_unlock(e);
+        }
+    }
+}
+
+// O(1): entries from older generations no longer match
+void tlb_flush(struct tlb *t) {
+    unsigned int gen = __atomic_add_fetch(&t->gen, 1, __ATOMIC_SEQ_CST);
+
+    // After wrap-around, ancient entries would match again, so sweep once
+    if (gen == 0) {
+        for (unsigned int i = 0; i < t->entries; i++) {
+            struct tlb_entry *e = &t->entry[i];
+            entry_lock(e);
+            STORE(&e->valid, 0);
+            entry_unlock(e);
+        }
+    }
+}
+
+const char *tlb_policy_name(int policy) {
+    return policy == TLB_POLICY_CLOCK ? "CLOCK" : "LRU";
+}
+
+// Drop everything cached under an older shootdown epoch
+void tlb_l1_sync(struct tlb_l1 *l1, unsigned int epoch) {
+    if (l1->epoch != epoch) {
+        memset(l1->valid, 0, sizeof(l1->valid));
+        l1->epoch = epoch;
+    }
+}
+
+int tlb_l1_lookup(struct tlb_l1 *l1, unsigned int asid, unsigned long vpn, unsigned long *ppn) {
+    unsigned int i = vpn % TLB_L1_ENTRIES;
+    if (l1->valid[i] && l1->vpn[i] == vpn && l1->asid[i] == asid) {
+        *ppn = l1->ppn[i];
+        return 1;
+    }
+    return 0;
+}
+
+void tlb_l1_insert(struct tlb_l1 *l1, unsigned int asid, unsigned long vpn, unsigned long ppn) {
+    unsigned int i = vpn % TLB_L1_ENTRIES;
+    l1->asid[i] = asid;
+    l1->vpn[i] = vpn;
+    l1->ppn[i] = ppn;
+    l1->valid[i] = 1;
+}
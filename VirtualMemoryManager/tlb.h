@@ -0,0 +1,96 @@
+#ifndef TLB_H_INCLUDED
+#define TLB_H_INCLUDED
+
+// N-way set-associative TLB shared by the VM engines.
+// The TLB only deals in page numbers; callers convert va/pa themselves.
+//
+// Lookups are lock-free: every entry carries a sequence number that is odd
+// while a writer is updating it, and readers retry-as-miss when it moves.
+// Writers take the odd sequence with a CAS, so it doubles as a per-entry
+// lock and no TLB operation needs a global mutex.
+//
+// Entries are also tagged with the TLB generation they were filled in, so
+// a whole-TLB flush is a single generation bump instead of a sweep.
+//
+// Every translation belongs to an address-space ID and lookups match on
+// (asid, vpn), so one TLB serves several address spaces and switching
+// between them needs no flush. Engines with a single space use ASID 0.
+// Each ASID has a generation of its own as well, so dropping one space's
+// translations is a bump too and leaves the other spaces' cached.
+
+// Default geometry
+#define TLB_ENTRIES 512
+#define TLB_WAYS 4
+
+// Geometry of the separate superpage TLB
+#define TLB_LARGE_ENTRIES 32
+#define TLB_LARGE_WAYS 4
+
+// ASIDs with a generation of their own; higher ones share (alias) them
+#define TLB_MAX_ASIDS 4096
+
+// Per-thread direct-mapped L1 in front of the shared TLB
+#define TLB_L1_ENTRIES 32
+
+// Replacement policies
+#define TLB_POLICY_LRU 0
+#define TLB_POLICY_CLOCK 1
+
+struct tlb_entry {
+    unsigned int seq;
+    unsigned int valid;
+    unsigned int gen;
+    unsigned int agen;      // Generation of its ASID
+    unsigned int asid;
+    unsigned long vpn;
+    unsigned long ppn;
+    unsigned int stamp;     // LRU: last-use tick, CLOCK: reference bit
+};
+
+struct tlb {
+    struct tlb_entry *entry;
+    unsigned int *hand;     // CLOCK hand, one per set
+    unsigned int entries;
+    unsigned int ways;
+    unsigned int sets;
+    unsigned int tick;
+    unsigned int gen;
+    unsigned int *agen;     // Per-ASID generations, TLB_MAX_ASIDS of them
+    int policy;
+};
+
+// Generations a reserved entry gets tagged with
+struct tlb_gen {
+    unsigned int all;
+    unsigned int space;
+};
+
+// Private to one thread, so no synchronization. The owner flushes it when
+// the global shootdown epoch moves past the one it was filled under.
+struct tlb_l1 {
+    unsigned int epoch;
+    unsigned int asid[TLB_L1_ENTRIES];
+    unsigned long vpn[TLB_L1_ENTRIES];
+    unsigned long ppn[TLB_L1_ENTRIES];
+    unsigned char valid[TLB_L1_ENTRIES];
+};
+
+int tlb_init(struct tlb *t, unsigned int entries, unsigned int ways, int policy);
+void tlb_destroy(struct tlb *t);
+int tlb_lookup(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long *ppn);
+void tlb_insert(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long ppn);
+struct tlb_entry *tlb_reserve(struct tlb *t, unsigned int asid, unsigned long vpn, struct tlb_gen *gen);
+void tlb_fill(struct tlb *t, struct tlb_entry *e, unsigned int asid, unsigned long vpn,
+              unsigned long ppn, struct tlb_gen gen);
+void tlb_release(struct tlb_entry *e);
+void tlb_invalidate(struct tlb *t, unsigned int asid, unsigned long vpn);
+void tlb_invalidate_range(struct tlb *t, unsigned int asid, unsigned long vpn, unsigned long npages);
+void tlb_flush_asid(struct tlb *t, unsigned int asid);
+void tlb_flush(struct tlb *t);
+const char *tlb_policy_name(int policy);
+
+void tlb_l1_sync(struct tlb_l1 *l1, unsigned int epoch);
+int tlb_l1_lookup(struct tlb_l1 *l1, unsigned int asid, unsigned long vpn, unsigned long *ppn);
+void tlb_l1_insert(struct tlb_l1 *l1, unsigned int asid, unsigned long vpn, unsigned long ppn);
+
+#endif